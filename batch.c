@@ -0,0 +1,317 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <mkl.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "trace.h"
+
+/* All kernels in here work on BATCH_LANES matrices of dimension dim at once,
+ * stored interleaved: entry (r,c) of the matrix in lane l is at
+ * a[(c*dim + r)*BATCH_LANES + l]. Right-hand sides are interleaved the same
+ * way, b[r*BATCH_LANES + l]. The innermost loops always run over the lanes,
+ * so the compiler can vectorize them no matter how small dim is. */
+#define A(r,c,l) a[((c)*dim + (r))*BATCH_LANES + (l)]
+#define B(r,l) b[(r)*BATCH_LANES + (l)]
+
+static MKL_INT batch_key(MKL_INT dim, MKL_INT max_dim) {
+  return dim < 1 || dim > max_dim ? max_dim+1 : dim;
+}
+
+/* Sort the columns first_col to last_col-1 for batched solving. Columns with
+ * submatrices of at most max_dim rows are bucketed by their dimension and
+ * cut into batches of up to BATCH_LANES columns. Batch b consists of the
+ * columns cols[batch_ptr[b]] to cols[batch_ptr[b+1]-1]. All remaining columns
+ * follow, starting at cols[batch_ptr[num_batches]]. Returns num_batches. */
+MKL_INT bucket_columns(MKL_INT *col_ptr, MKL_INT first_col, MKL_INT last_col,
+                       MKL_INT max_dim, MKL_INT *cols, MKL_INT *batch_ptr) {
+  MKL_INT i, d, count, pos, num_batches, *bucket;
+
+  /* Counting sort by dimension. Everything we do not batch goes into the
+   * last bucket. */
+  bucket = (MKL_INT*) calloc(max_dim+2, sizeof(MKL_INT));
+  for (i = first_col; i < last_col; i++) {
+    bucket[batch_key(col_ptr[i+1] - col_ptr[i], max_dim)]++;
+  }
+  for (pos = 0, d = 0; d <= max_dim+1; d++) {
+    count = bucket[d];
+    bucket[d] = pos;
+    pos += count;
+  }
+  for (i = first_col; i < last_col; i++) {
+    cols[bucket[batch_key(col_ptr[i+1] - col_ptr[i], max_dim)]++] = i;
+  }
+
+  // Now bucket[d] is where the columns of dimension d end
+  num_batches = 0;
+  batch_ptr[0] = 0;
+  for (pos = 0, d = 1; d <= max_dim; d++) {
+    while (pos < bucket[d]) {
+      pos += BATCH_LANES;
+      if (pos > bucket[d]) {
+        pos = bucket[d];
+      }
+      batch_ptr[++num_batches] = pos;
+    }
+  }
+  free(bucket);
+  return num_batches;
+}
+
+/* LU factorization with partial pivoting, the same as ?getrf does for each
+ * lane. The pivot of step k in lane l is ipiv[k*BATCH_LANES + l]. Returns a
+ * bit mask of the lanes that turned out to be singular. */
+int batch_lu(double *a, MKL_INT dim, MKL_INT *ipiv) {
+  MKL_INT k, r, c, l;
+  int failed = 0;
+  double best[BATCH_LANES], tmp;
+
+  for (k = 0; k < dim; k++) {
+    for (l = 0; l < BATCH_LANES; l++) {
+      best[l] = fabs(A(k,k,l));
+      ipiv[k*BATCH_LANES + l] = k;
+    }
+    for (r = k+1; r < dim; r++) {
+      #pragma omp simd
+      for (l = 0; l < BATCH_LANES; l++) {
+        if (fabs(A(r,k,l)) > best[l]) {
+          best[l] = fabs(A(r,k,l));
+          ipiv[k*BATCH_LANES + l] = r;
+        }
+      }
+    }
+    // Row swaps differ from lane to lane, so these are done one by one
+    for (l = 0; l < BATCH_LANES; l++) {
+      r = ipiv[k*BATCH_LANES + l];
+      if (r != k) {
+        for (c = 0; c < dim; c++) {
+          tmp = A(k,c,l);
+          A(k,c,l) = A(r,c,l);
+          A(r,c,l) = tmp;
+        }
+      }
+      if (A(k,k,l) == .0) {
+        failed |= 1 << l;
+        A(k,k,l) = 1.;
+      }
+    }
+    for (r = k+1; r < dim; r++) {
+      #pragma omp simd
+      for (l = 0; l < BATCH_LANES; l++) {
+        A(r,k,l) /= A(k,k,l);
+      }
+    }
+    for (c = k+1; c < dim; c++) {
+      for (r = k+1; r < dim; r++) {
+        #pragma omp simd
+        for (l = 0; l < BATCH_LANES; l++) {
+          A(r,c,l) -= A(r,k,l) * A(k,c,l);
+        }
+      }
+    }
+  }
+  return failed;
+}
+
+void batch_lu_solve(double *a, MKL_INT dim, MKL_INT *ipiv, double *b) {
+  MKL_INT k, r, l;
+  double tmp;
+
+  for (k = 0; k < dim; k++) {
+    for (l = 0; l < BATCH_LANES; l++) {
+      r = ipiv[k*BATCH_LANES + l];
+      tmp = B(k,l);
+      B(k,l) = B(r,l);
+      B(r,l) = tmp;
+    }
+  }
+  // Forward substitution with the unit lower triangle
+  for (k = 0; k < dim; k++) {
+    for (r = k+1; r < dim; r++) {
+      #pragma omp simd
+      for (l = 0; l < BATCH_LANES; l++) {
+        B(r,l) -= A(r,k,l) * B(k,l);
+      }
+    }
+  }
+  // Backward substitution with the upper triangle
+  for (k = dim-1; k >= 0; k--) {
+    #pragma omp simd
+    for (l = 0; l < BATCH_LANES; l++) {
+      B(k,l) /= A(k,k,l);
+    }
+    for (r = 0; r < k; r++) {
+      #pragma omp simd
+      for (l = 0; l < BATCH_LANES; l++) {
+        B(r,l) -= A(r,k,l) * B(k,l);
+      }
+    }
+  }
+}
+
+/* Cholesky factorization A = L L^T using the lower triangle, like ?potrf
+ * with 'L'. Returns a bit mask of the lanes that are not positive
+ * definite. */
+int batch_cholesky(double *a, MKL_INT dim) {
+  MKL_INT j, k, r, l;
+  int failed = 0;
+
+  for (j = 0; j < dim; j++) {
+    for (l = 0; l < BATCH_LANES; l++) {
+      if (A(j,j,l) <= .0) {
+        failed |= 1 << l;
+        A(j,j,l) = 1.;
+      }
+    }
+    #pragma omp simd
+    for (l = 0; l < BATCH_LANES; l++) {
+      A(j,j,l) = sqrt(A(j,j,l));
+    }
+    for (r = j+1; r < dim; r++) {
+      #pragma omp simd
+      for (l = 0; l < BATCH_LANES; l++) {
+        A(r,j,l) /= A(j,j,l);
+      }
+    }
+    // Update the trailing lower triangle
+    for (k = j+1; k < dim; k++) {
+      for (r = k; r < dim; r++) {
+        #pragma omp simd
+        for (l = 0; l < BATCH_LANES; l++) {
+          A(r,k,l) -= A(r,j,l) * A(k,j,l);
+        }
+      }
+    }
+  }
+  return failed;
+}
+
+void batch_cholesky_solve(double *a, MKL_INT dim, double *b) {
+  MKL_INT k, r, l;
+
+  // L y = b
+  for (k = 0; k < dim; k++) {
+    #pragma omp simd
+    for (l = 0; l < BATCH_LANES; l++) {
+      B(k,l) /= A(k,k,l);
+    }
+    for (r = k+1; r < dim; r++) {
+      #pragma omp simd
+      for (l = 0; l < BATCH_LANES; l++) {
+        B(r,l) -= A(r,k,l) * B(k,l);
+      }
+    }
+  }
+  // L^T x = y
+  for (k = dim-1; k >= 0; k--) {
+    for (r = k+1; r < dim; r++) {
+      #pragma omp simd
+      for (l = 0; l < BATCH_LANES; l++) {
+        B(k,l) -= A(r,k,l) * B(r,l);
+      }
+    }
+    #pragma omp simd
+    for (l = 0; l < BATCH_LANES; l++) {
+      B(k,l) /= A(k,k,l);
+    }
+  }
+}
+
+/* Solve the submatrices of up to BATCH_LANES columns that all have the same
+ * dimension, writing the result of column cols[c] to out[c]. Unused lanes
+ * hold identity matrices. Lanes the batched kernels cannot handle (singular,
+ * or not positive definite for Cholesky) are solved again one by one with
+ * LAPACK's LU, after the batch is done with ws. */
+void solve_batch(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                 MKL_INT *cols, MKL_INT ncols, double **out,
+                 struct solver_options *opts, struct workspace *ws,
+                 double *locDurBuild, double *locDurCalc) {
+  MKL_INT dim, l, r, *ipiv;
+  int failed;
+  double *a, *b, tStart, tEnd, build, calc;
+  struct solver_options lu;
+
+  dim = col_ptr[cols[0]+1] - col_ptr[cols[0]];
+  workspace_reserve(ws, (dim*dim + dim) * BATCH_LANES * sizeof(double) +
+                        dim * BATCH_LANES * sizeof(MKL_INT) + 3*64);
+  a = (double*) workspace_calloc(ws, dim*dim*BATCH_LANES, sizeof(double));
+  b = (double*) workspace_calloc(ws, dim*BATCH_LANES, sizeof(double));
+  ipiv = (MKL_INT*) workspace_alloc(ws, dim*BATCH_LANES*sizeof(MKL_INT));
+
+  tStart = omp_get_wtime();
+  for (l = 0; l < BATCH_LANES; l++) {
+    if (l < ncols) {
+      assemble_values(values, row_ind, col_ptr, &(row_ind[col_ptr[cols[l]]]),
+                      dim, opts->assembly, BATCH_LANES, &(a[l]), ws);
+      B(find_elem(cols[l], &(row_ind[col_ptr[cols[l]]]), dim), l) = 1.;
+    } else {
+      for (r = 0; r < dim; r++) {
+        A(r,r,l) = 1.;
+      }
+    }
+  }
+  tEnd = omp_get_wtime();
+  *locDurBuild = (tEnd - tStart);
+  trace_event(TRACE_ASSEMBLY, cols[0], dim, ncols, tStart, tEnd);
+
+  tStart = omp_get_wtime();
+  if (opts->method == SOLVER_CHOLESKY) {
+    failed = batch_cholesky(a, dim);
+    batch_cholesky_solve(a, dim, b);
+  } else {
+    failed = batch_lu(a, dim, ipiv);
+    batch_lu_solve(a, dim, ipiv, b);
+  }
+  tEnd = omp_get_wtime();
+  *locDurCalc = (tEnd - tStart);
+  trace_event(TRACE_FACTOR, cols[0], dim, ncols, tStart, tEnd);
+
+  tStart = trace_clock();
+  for (l = 0; l < ncols; l++) {
+    if (!(failed & (1 << l))) {
+      for (r = 0; r < dim; r++) {
+        out[l][r] = B(r,l);
+      }
+      // Each lane took its share of the batch, the failed ones count later
+      workspace_count(ws, dim, submatrix_flops(dim, 1, opts),
+                      (*locDurBuild + *locDurCalc) / ncols);
+    }
+  }
+  trace_event(TRACE_EXTRACT, cols[0], dim, ncols, tStart, trace_clock());
+
+  // Solving the failed lanes reuses ws, so a and b are gone from here on
+  lu = *opts;
+  lu.method = SOLVER_LU;
+  for (l = 0; l < ncols; l++) {
+    if (failed & (1 << l)) {
+      invert_submatrix(values, row_ind, col_ptr, out[l], cols[l], &lu, ws,
+                       &build, &calc);
+      *locDurBuild += build;
+      *locDurCalc += calc;
+    }
+  }
+}
@@ -0,0 +1,23 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <mkl.h>
+#include "submatrix.h"
+
+/* Number of submatrices that are solved side by side. Eight doubles fill one
+ * AVX-512 register, so every lane of a vector instruction works on a
+ * different submatrix. */
+#define BATCH_LANES 8
+
+MKL_INT bucket_columns(MKL_INT *col_ptr, MKL_INT first_col, MKL_INT last_col,
+                       MKL_INT max_dim, MKL_INT *cols, MKL_INT *batch_ptr);
+int batch_lu(double *a, MKL_INT dim, MKL_INT *ipiv);
+int batch_cholesky(double *a, MKL_INT dim);
+void batch_lu_solve(double *a, MKL_INT dim, MKL_INT *ipiv, double *b);
+void batch_cholesky_solve(double *a, MKL_INT dim, double *b);
+void solve_batch(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                 MKL_INT *cols, MKL_INT ncols, double **out,
+                 struct solver_options *opts, struct workspace *ws,
+                 double *locDurBuild, double *locDurCalc);
+
+#endif
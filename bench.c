@@ -0,0 +1,133 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mkl.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+/* Open path for the records of a benchmark, CSV if it ends in .csv and JSON
+ * lines otherwise. An existing file is replaced. */
+int bench_open(const char *path, struct bench_file *b) {
+  size_t len = strlen(path);
+
+  b->format = len >= 4 && strcmp(path + len - 4, ".csv") == 0 ? BENCH_CSV :
+              BENCH_JSON;
+  b->fp = fopen(path, "w");
+  if (!b->fp) {
+    fprintf(stderr, "%s: Cannot open file for writing\n", path);
+    return -1;
+  }
+  if (b->format == BENCH_CSV) {
+    fprintf(b->fp, "size,density,condition,input,job,round,warmup,ranks,"
+            "imbalance,residual_f,residual_2,rank,threads,dist,wall,build,"
+            "calc,gather,columns,submatrices,flops,gflops,dim_hist,"
+            "time_hist\n");
+  }
+  return 0;
+}
+
+/* Collect the records of all ranks in all, which only rank 0 needs */
+void bench_gather(struct bench_record *mine, struct bench_record *all,
+                  MPI_Comm comm) {
+  MPI_Gather(mine, sizeof(*mine), MPI_BYTE, all, sizeof(*mine), MPI_BYTE, 0,
+             comm);
+}
+
+/* The slowest wall time over the mean, among the ranks that solved
+ * anything. 1 is perfect balance. */
+double bench_imbalance(struct bench_record *recs, int num) {
+  double max = .0, sum = .0;
+  int r, solving = 0;
+
+  for (r = 0; r < num; r++) {
+    if (recs[r].columns > 0) {
+      sum += recs[r].wall;
+      max = recs[r].wall > max ? recs[r].wall : max;
+      solving++;
+    }
+  }
+  return sum > .0 ? max / (sum / solving) : 1.;
+}
+
+/* The histogram with trailing empty bins left out */
+static void write_hist(FILE *fp, MKL_INT *hist, const char *sep) {
+  int b, last = 0;
+  for (b = 0; b < HIST_BINS; b++) {
+    if (hist[b]) {
+      last = b;
+    }
+  }
+  for (b = 0; b <= last; b++) {
+    fprintf(fp, "%s%d", b ? sep : "", (int)hist[b]);
+  }
+}
+
+void bench_write(struct bench_file *b, struct bench_record *recs, int num) {
+  struct bench_record *r;
+  double gflops;
+  int i;
+
+  for (i = 0; i < num; i++) {
+    r = &(recs[i]);
+    gflops = r->wall > .0 ? r->flops / r->wall / 1e9 : .0;
+    if (b->format == BENCH_CSV) {
+      fprintf(b->fp, "%d,%d,%d,%d,%d,%d,%d,%d,%.4f,%.6e,%.6e,%d,%d,%.6f,"
+              "%.6f,%.6f,%.6f,%.6f,%d,%d,%.6e,%.4f,\"", r->size, r->density,
+              r->condition, r->input, r->job, r->round, r->warmup, r->ranks,
+              r->imbalance, r->residual_f, r->residual_2, r->rank, r->threads,
+              r->dist, r->wall, r->build, r->calc, r->gather,
+              (int)r->columns, (int)r->submatrices, r->flops, gflops);
+      write_hist(b->fp, r->dim_hist, " ");
+      fprintf(b->fp, "\",\"");
+      write_hist(b->fp, r->time_hist, " ");
+      fprintf(b->fp, "\"\n");
+    } else {
+      fprintf(b->fp, "{\"size\": %d, \"density\": %d, \"condition\": %d, "
+              "\"input\": %d, \"job\": %d, \"round\": %d, \"warmup\": %s, "
+              "\"ranks\": %d, \"imbalance\": %.4f, \"residual_f\": %.6e, "
+              "\"residual_2\": %.6e, \"rank\": %d, \"threads\": %d, "
+              "\"dist\": %.6f, \"wall\": %.6f, \"build\": %.6f, "
+              "\"calc\": %.6f, \"gather\": %.6f, \"columns\": %d, "
+              "\"submatrices\": %d, \"flops\": %.6e, \"gflops\": %.4f, "
+              "\"dim_hist\": [", r->size, r->density,
+              r->condition, r->input, r->job, r->round,
+              r->warmup ? "true" : "false", r->ranks, r->imbalance,
+              r->residual_f, r->residual_2, r->rank,
+              r->threads, r->dist, r->wall, r->build, r->calc, r->gather,
+              (int)r->columns, (int)r->submatrices, r->flops, gflops);
+      write_hist(b->fp, r->dim_hist, ", ");
+      fprintf(b->fp, "], \"time_hist\": [");
+      write_hist(b->fp, r->time_hist, ", ");
+      fprintf(b->fp, "]}\n");
+    }
+  }
+  // Keep what we have if a later job fails
+  fflush(b->fp);
+}
+
+void bench_close(struct bench_file *b) {
+  fclose(b->fp);
+}
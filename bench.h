@@ -0,0 +1,59 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <mkl.h>
+#include <mpi.h>
+#include <stdio.h>
+#include "workspace.h"
+
+/* Most inputs a benchmark can cycle through, see -n */
+#define MAX_INPUTS 16
+
+enum bench_format {
+  BENCH_JSON = 0, // one JSON object per line
+  BENCH_CSV  = 1
+};
+
+/* What one rank did in one job. Every rank fills in its own times and
+ * counts, rank 0 gathers them and adds the description of the job. */
+struct bench_record {
+  // The job, the same for all ranks
+  int size;
+  int density;
+  int condition;
+  int input;
+  int job;           // counting from 0, warm-up runs included
+  int round;         // repetition of this input, warm-up runs first
+  int warmup;        // 1 for a warm-up run
+  int ranks;
+  double imbalance;  // slowest wall time over the mean of the solving ranks
+  double residual_f; // estimates of ||X^p A - I|| in the Frobenius and
+  double residual_2; // spectral norm with -V, 0 otherwise
+  // This rank
+  int rank;
+  int threads;
+  double dist;       // getting the matrix: Bcast, halo or MPI-IO input
+  double wall;       // solving the submatrices
+  double build;      // CPU time of all threads, as in print_solve_stats
+  double calc;
+  double gather;     // getting the results out: Gatherv or MPI-IO output
+  MKL_INT columns;
+  MKL_INT submatrices;
+  double flops;      // estimated, see submatrix_flops
+  MKL_INT dim_hist[HIST_BINS];
+  MKL_INT time_hist[HIST_BINS];
+};
+
+struct bench_file {
+  FILE *fp;
+  int format;
+};
+
+int bench_open(const char *path, struct bench_file *b);
+void bench_gather(struct bench_record *mine, struct bench_record *all,
+                  MPI_Comm comm);
+double bench_imbalance(struct bench_record *recs, int num);
+void bench_write(struct bench_file *b, struct bench_record *recs, int num);
+void bench_close(struct bench_file *b);
+
+#endif
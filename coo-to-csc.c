@@ -0,0 +1,139 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mkl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "csc_io.h"
+#include "matrix_io.h"
+
+/* Drop the entries above ('L') or below ('U') the diagonal in place */
+static void keep_triangle(MKL_INT size, MKL_INT *col_ptr, MKL_INT *row_ind,
+                          double *values, int triangle) {
+  MKL_INT j, k, first, pos = 0;
+  for (j = 0; j < size; j++) {
+    first = col_ptr[j];
+    col_ptr[j] = pos;
+    for (k = first; k < col_ptr[j+1]; k++) {
+      if (triangle == 'L' ? row_ind[k] >= j : row_ind[k] <= j) {
+        row_ind[pos] = row_ind[k];
+        values[pos++] = values[k];
+      }
+    }
+  }
+  col_ptr[size] = pos;
+}
+
+int main(int argc, char* argv[]) {
+
+  struct coordinate_info info;
+  MKL_INT *row_ind, *col_ptr; //CSC
+  MKL_INT ret, intsize;
+  double *cscval;
+  int triple = 0, triangle = 0, symmetric, opt;
+
+  memset(&info, 0, sizeof(info));
+  while ((opt = getopt(argc, argv, "tmluN:")) != -1) {
+    switch (opt) {
+      case 't':
+        // write the old .val/.ri/.cp files instead of the container
+        triple = 1;
+        break;
+      case 'm':
+        // a plain coordinate file holding one triangle of a symmetric matrix
+        info.mirror = 1;
+        break;
+      case 'l':
+      case 'u':
+        triangle = opt == 'l' ? 'L' : 'U';
+        break;
+      case 'N':
+        info.size = strtol(optarg, NULL, 10);
+        break;
+      default:
+        argc = 0;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr,
+      "Usage: ./coo-to-csc [-t] [-m] [-l|-u] [-N matrix_size] input-file "
+      "output-name\n"
+      "  input-file holds lines of \"row column value\" with indices from 1,\n"
+      "  or is a coordinate Matrix Market file. Without -N the largest index\n"
+      "  of a plain file is the size. -m mirrors a plain file that holds one\n"
+      "  triangle of a symmetric matrix, Matrix Market files say so in their\n"
+      "  header. -l or -u keep only the lower or upper triangle of symmetric\n"
+      "  matrices, mpi-matrix-inv needs the full matrix.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Parse the entries in parallel and sort them into CSC by column */
+  if (read_coordinate_csc_d(argv[optind], &info, &col_ptr, &row_ind,
+                            &cscval) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  intsize = (MKL_INT)info.size;
+  symmetric = info.mirror == 1 ||
+              (info.mirror == 0 &&
+               csc_is_symmetric(intsize, col_ptr, row_ind, cscval));
+  printf("%s: %ld x %ld, %ld entries%s, %ld nonzeros, %s\n", argv[optind],
+         info.size, info.size, info.entries,
+         info.mirror ? " of one triangle" : "", (long)col_ptr[intsize],
+         symmetric ? "symmetric" :
+         info.mirror == -1 ? "skew-symmetric" : "not symmetric");
+  if (!info.mirror && info.triangle) {
+    fprintf(stderr, "WARNING: Only the %s triangle is stored. Use -m if it is "
+            "half of a symmetric matrix.\n",
+            info.triangle == 'L' ? "lower" : "upper");
+  }
+  if (triangle) {
+    if (!symmetric) {
+      fprintf(stderr, "WARNING: The matrix is not symmetric, keeping both "
+              "triangles. Ignoring -%c.\n", triangle == 'L' ? 'l' : 'u');
+    } else {
+      keep_triangle(intsize, col_ptr, row_ind, cscval, triangle);
+      // The flag says CSC equals CSR, which a triangle alone is not
+      symmetric = 0;
+    }
+  }
+
+  /* Write binary data into the container output-name.csc, or with -t into
+   * three separate files. */
+  if (triple) {
+    ret = csc_write_triple(argv[optind+1], intsize, col_ptr, row_ind, cscval);
+  } else {
+    ret = csc_write(argv[optind+1], intsize, col_ptr, row_ind, cscval,
+                    symmetric);
+  }
+  if (ret != 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  free(row_ind);
+  free(cscval);
+  free(col_ptr);
+  exit(EXIT_SUCCESS);
+}
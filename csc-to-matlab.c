@@ -22,77 +22,47 @@
  * SOFTWARE.
  */
 
-#include <fcntl.h>
 #include <mkl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
-#include <unistd.h>
+#include <string.h>
+#include "csc_io.h"
 #include "matrix_io.h"
 
-#define PATHLEN 255
-
 int main(int argc, char* argv[]) {
 
-  long size, total_nnz;
-  MKL_INT *row_ind, *col_ptr; //CSC
-  MKL_INT *col_ind, *row_ptr; //CSR
-  MKL_INT ret, intsize;
-  double *matrix, *csrval, *cscval;
-  char fn_in_val[PATHLEN], fn_in_ri[PATHLEN], fn_in_cp[PATHLEN];
-  FILE *fp;
-  int fd;
+  long size;
+  struct csc_matrix in;
+  int format = TEXT_EXP;
 
-  if (argc != 4) {
+  // -s writes the shortest text that reads back exactly instead of %e
+  if (argc > 1 && strcmp(argv[1], "-s") == 0) {
+    format = TEXT_SHORTEST;
+    argc--;
+    argv++;
+  }
+  // The size is stored with the matrix, giving it is optional
+  if (argc != 3 && argc != 4) {
     fprintf(stderr,
-      "Usage: ./csc-to-matlab matrix_size input-name output-file.txt\n");
+      "Usage: ./csc-to-matlab [-s] [matrix_size] input-name output-file.txt\n");
     exit(EXIT_FAILURE);
   }
-  size = strtol(argv[1], NULL, 10);
-  intsize = (MKL_INT)size;
-  snprintf(fn_in_val, PATHLEN, "%s.val", argv[2]);
-  snprintf(fn_in_ri, PATHLEN, "%s.ri", argv[2]);
-  snprintf(fn_in_cp, PATHLEN, "%s.cp", argv[2]);
-
-  fd = open(fn_in_cp, O_RDONLY);
-  col_ptr = (MKL_INT*) mmap(NULL, (size+1)*sizeof(MKL_INT), PROT_READ,
-    MAP_SHARED, fd, 0);
-  close(fd);
-  total_nnz = col_ptr[size];
-  fd = open(fn_in_ri, O_RDONLY);
-  row_ind = (MKL_INT*) mmap(NULL, total_nnz*sizeof(MKL_INT), PROT_READ,
-    MAP_SHARED, fd, 0);
-  close(fd);
-  fd = open(fn_in_val, O_RDONLY);
-  cscval = (double*) mmap(NULL, total_nnz*sizeof(double), PROT_READ,
-    MAP_SHARED, fd, 0);
-  close(fd);
-
-  matrix = (double*) mkl_calloc(size*size, sizeof(double), 64);
-  csrval = (double*) mkl_calloc(total_nnz, sizeof(double), 64);
-  col_ind = (MKL_INT*) mkl_calloc(total_nnz, sizeof(MKL_INT), 64);
-  row_ptr = (MKL_INT*) mkl_calloc(size+1, sizeof(MKL_INT), 64);
-
-  /* Now we do the inverse of what we do inn matlab-to-csc -- first to CSR and
-   * then to full matrix format. */
-  MKL_INT job1[6] = {1,0,0,0,0,1};
-  mkl_dcsrcsc (job1, &intsize, csrval, col_ind, row_ptr, cscval, row_ind,
-    col_ptr, &ret);
-  MKL_INT job2[6] = {1,0,0,2,0,1};
-  mkl_ddnscsr (job2, &intsize, &intsize, matrix, &intsize, csrval, col_ind,
-    row_ptr, &ret);
-  if (ret != 0) {
-    fprintf(stderr, "Oh oh, something went wrong :(\n");
+  if (csc_read(argv[argc-2], CSC_VERIFY | CSC_SYMMETRY, &in) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  size = in.size;
+  if (argc == 4 && strtol(argv[1], NULL, 10) != size) {
+    fprintf(stderr, "%s has size %ld, not %s\n", argv[2], size, argv[1]);
+    exit(EXIT_FAILURE);
   }
 
-  write_output_matrix_d(matrix, size, argv[3]);
+  /* Stream the rows straight from CSC instead of going through CSR and a
+   * dense matrix as we used to. */
+  if (write_output_csc_d(argv[argc-1], size, in.col_ptr, in.row_ind,
+                         in.values, in.symmetric == 1, format) != 0) {
+    exit(EXIT_FAILURE);
+  }
 
-  mkl_free(row_ptr);
-  mkl_free(col_ind);
-  mkl_free(csrval);
-  mkl_free(matrix);
-  munmap(cscval, total_nnz*sizeof(double));
-  munmap(row_ind, total_nnz*sizeof(MKL_INT));
-  munmap(col_ptr, (size+1)*sizeof(MKL_INT));
+  csc_close(&in);
   exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,422 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <mkl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "csc_io.h"
+
+#define PATHLEN 255
+
+uint64_t csc_checksum(const void *data, size_t bytes) {
+  const unsigned char *p = (const unsigned char*) data;
+  uint64_t hash = 14695981039346656037UL;
+  size_t i;
+  for (i = 0; i < bytes; i++) {
+    hash ^= p[i];
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+static uint64_t header_checksum(const struct csc_header *h) {
+  return csc_checksum(h, offsetof(struct csc_header, header_checksum));
+}
+
+/* Whether h is the header of a container this version can read. */
+int csc_header_valid(const struct csc_header *h) {
+  return memcmp(h->magic, CSC_MAGIC, sizeof(CSC_MAGIC)) == 0 &&
+         h->version == CSC_VERSION && h->header_checksum == header_checksum(h);
+}
+
+static uint64_t align_up(uint64_t offset) {
+  return (offset + CSC_ALIGN-1) / CSC_ALIGN * CSC_ALIGN;
+}
+
+// Binary search for row r among the sorted rows of column c
+static MKL_INT find_row(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT c,
+                        MKL_INT r) {
+  MKL_INT l = col_ptr[c], u = col_ptr[c+1], m;
+  while (l < u) {
+    m = (l+u)/2;
+    if (row_ind[m] == r) {
+      return m;
+    }
+    if (row_ind[m] < r) {
+      l = m+1;
+    } else {
+      u = m;
+    }
+  }
+  return -1;
+}
+
+int csc_is_symmetric(MKL_INT size, MKL_INT *col_ptr, MKL_INT *row_ind,
+                     double *values) {
+  MKL_INT j, p, q;
+  for (j = 0; j < size; j++) {
+    for (p = col_ptr[j]; p < col_ptr[j+1]; p++) {
+      q = find_row(col_ptr, row_ind, row_ind[p], j);
+      if (q < 0 || values[q] != values[p]) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/* Make count indices of width bytes at src usable as MKL_INT. They are used
+ * in place if the width matches and the caller does not want a copy. */
+static MKL_INT *load_indices(const char *src, uint32_t width, size_t count,
+                             int copy, int *allocated) {
+  MKL_INT *dst;
+  int64_t v;
+  size_t i;
+
+  if (width == sizeof(MKL_INT) && !copy) {
+    *allocated = 0;
+    return (MKL_INT*) src;
+  }
+  *allocated = 1;
+  dst = (MKL_INT*) malloc((count ? count : 1) * sizeof(MKL_INT));
+  for (i = 0; i < count; i++) {
+    v = width == 8 ? ((const int64_t*)src)[i] : ((const int32_t*)src)[i];
+    if ((MKL_INT)v != v) {
+      fprintf(stderr, "Index %ld does not fit into MKL_INT\n", (long)v);
+      free(dst);
+      return NULL;
+    }
+    dst[i] = (MKL_INT)v;
+  }
+  return dst;
+}
+
+static double *load_values(const char *src, uint32_t type, size_t count,
+                           int copy, int *allocated) {
+  double *dst;
+  size_t i;
+
+  if (type == CSC_DOUBLE && !copy) {
+    *allocated = 0;
+    return (double*) src;
+  }
+  *allocated = 1;
+  dst = (double*) malloc((count ? count : 1) * sizeof(double));
+  if (type == CSC_DOUBLE) {
+    memcpy(dst, src, count * sizeof(double));
+  } else {
+    for (i = 0; i < count; i++) {
+      dst[i] = ((const float*)src)[i];
+    }
+  }
+  return dst;
+}
+
+static int read_container(const char *path, int fd, int flags,
+                          struct csc_matrix *m) {
+  struct stat st;
+  struct csc_header *h;
+  char *base;
+  size_t value_width;
+  int allocated[3], i;
+
+  fstat(fd, &st);
+  if ((size_t)st.st_size < sizeof(struct csc_header)) {
+    fprintf(stderr, "%s: File too short for a header\n", path);
+    return -1;
+  }
+  base = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "%s: Cannot map file\n", path);
+    return -1;
+  }
+  h = (struct csc_header*) base;
+  if (!csc_header_valid(h)) {
+    fprintf(stderr, "%s: Not a CSC container of version %d\n", path,
+            CSC_VERSION);
+    munmap(base, st.st_size);
+    return -1;
+  }
+  value_width = h->value_type == CSC_FLOAT ? sizeof(float) : sizeof(double);
+  if ((h->index_width != 4 && h->index_width != 8) ||
+      (h->value_type != CSC_DOUBLE && h->value_type != CSC_FLOAT) ||
+      h->col_ptr_offset + (h->size+1) * h->index_width > (size_t)st.st_size ||
+      h->row_ind_offset + h->nnz * h->index_width > (size_t)st.st_size ||
+      h->values_offset + h->nnz * value_width > (size_t)st.st_size) {
+    fprintf(stderr, "%s: Corrupt header\n", path);
+    munmap(base, st.st_size);
+    return -1;
+  }
+  if ((flags & CSC_VERIFY) &&
+      (csc_checksum(base + h->col_ptr_offset,
+                    (h->size+1) * h->index_width) != h->col_ptr_checksum ||
+       csc_checksum(base + h->row_ind_offset,
+                    h->nnz * h->index_width) != h->row_ind_checksum ||
+       csc_checksum(base + h->values_offset,
+                    h->nnz * value_width) != h->values_checksum)) {
+    fprintf(stderr, "%s: Checksum mismatch\n", path);
+    munmap(base, st.st_size);
+    return -1;
+  }
+
+  if ((MKL_INT)(h->size+1) != h->size+1 || (MKL_INT)h->nnz != h->nnz) {
+    fprintf(stderr, "%s: Matrix too large for MKL_INT\n", path);
+    munmap(base, st.st_size);
+    return -1;
+  }
+
+  m->size = h->size;
+  m->nnz = h->nnz;
+  m->symmetric = (h->flags & CSC_SYMMETRIC) != 0;
+  m->col_ptr = load_indices(base + h->col_ptr_offset, h->index_width,
+                            h->size+1, flags & CSC_COPY, &(allocated[0]));
+  m->row_ind = load_indices(base + h->row_ind_offset, h->index_width, h->nnz,
+                            flags & CSC_COPY, &(allocated[1]));
+  m->values = load_values(base + h->values_offset, h->value_type, h->nnz,
+                          flags & CSC_COPY, &(allocated[2]));
+  // Until we are done everything belongs to m, so csc_close cleans up
+  for (i = 0, m->owned = 0; i < 3; i++) {
+    if (allocated[i]) {
+      m->owned |= 1 << i;
+    }
+  }
+  m->maps[0] = base;
+  m->map_lengths[0] = st.st_size;
+  if (m->col_ptr == NULL || m->row_ind == NULL) {
+    fprintf(stderr, "%s: Corrupt indices\n", path);
+    csc_close(m);
+    return -1;
+  }
+
+  if (allocated[0] && allocated[1] && allocated[2]) {
+    munmap(base, st.st_size);
+    m->maps[0] = NULL;
+    m->map_lengths[0] = 0;
+  }
+  // Copies belong to the caller with CSC_COPY
+  if (flags & CSC_COPY) {
+    m->owned = 0;
+  }
+  return 0;
+}
+
+// Array i of a triple, in the order of the files
+static void set_array(struct csc_matrix *m, int i, void *data) {
+  if (i == 0) {
+    m->col_ptr = (MKL_INT*) data;
+  } else if (i == 1) {
+    m->row_ind = (MKL_INT*) data;
+  } else {
+    m->values = (double*) data;
+  }
+}
+
+/* The old layout: the headerless files <name>.cp, <name>.ri and <name>.val
+ * with MKL_INT indices and double values. The size follows from the length
+ * of <name>.cp. Everything read so far is kept in m, so a failure only needs
+ * csc_close. */
+static int read_triple(const char *name, int flags, struct csc_matrix *m) {
+  const char *suffix[3] = {"cp", "ri", "val"};
+  size_t width[3] = {sizeof(MKL_INT), sizeof(MKL_INT), sizeof(double)};
+  size_t count[3];
+  char path[PATHLEN];
+  void *data;
+  struct stat st;
+  int i, fd;
+
+  for (i = 0; i < 3; i++) {
+    snprintf(path, PATHLEN, "%s.%s", name, suffix[i]);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "%s: Cannot open file\n", path);
+      csc_close(m);
+      return -1;
+    }
+    fstat(fd, &st);
+    if (i == 0) {
+      count[0] = st.st_size / sizeof(MKL_INT);
+      if (count[0] == 0) {
+        fprintf(stderr, "%s: Empty file\n", path);
+        close(fd);
+        csc_close(m);
+        return -1;
+      }
+    } else {
+      count[i] = m->col_ptr[count[0]-1];
+      if ((size_t)st.st_size < count[i] * width[i]) {
+        fprintf(stderr, "%s: File too short for %ld nonzeros\n", path,
+                (long)count[i]);
+        close(fd);
+        csc_close(m);
+        return -1;
+      }
+    }
+    // Empty arrays cannot be mapped, they get a buffer of their own
+    if ((flags & CSC_COPY) || count[i] == 0) {
+      data = malloc((count[i] ? count[i] : 1) * width[i]);
+      set_array(m, i, data);
+      m->owned |= 1 << i;
+      if (pread(fd, data, count[i] * width[i], 0) !=
+          (ssize_t)(count[i] * width[i])) {
+        fprintf(stderr, "%s: Short read\n", path);
+        close(fd);
+        csc_close(m);
+        return -1;
+      }
+    } else {
+      data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (data == MAP_FAILED) {
+        fprintf(stderr, "%s: Cannot map file\n", path);
+        close(fd);
+        csc_close(m);
+        return -1;
+      }
+      set_array(m, i, data);
+      m->maps[i] = data;
+      m->map_lengths[i] = st.st_size;
+    }
+    close(fd);
+  }
+
+  // Copies belong to the caller with CSC_COPY
+  if (flags & CSC_COPY) {
+    m->owned = 0;
+  }
+  m->size = count[0] - 1;
+  m->nnz = count[1];
+  // Finding out means touching every page, so only do it when asked to
+  m->symmetric = (flags & CSC_SYMMETRY) ?
+                 csc_is_symmetric(m->size, m->col_ptr, m->row_ind, m->values) :
+                 -1;
+  return 0;
+}
+
+/* Read the matrix called name: the container <name>.csc if there is one,
+ * otherwise the triple files. Returns 0 on success. */
+int csc_read(const char *name, int flags, struct csc_matrix *m) {
+  char path[PATHLEN];
+  int fd, ret;
+
+  memset(m, 0, sizeof(*m));
+  snprintf(path, PATHLEN, "%s.csc", name);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return read_triple(name, flags, m);
+  }
+  ret = read_container(path, fd, flags, m);
+  close(fd);
+  return ret;
+}
+
+// Write bytes and pad with zeros up to the next multiple of CSC_ALIGN
+static void write_section(FILE *fp, const void *data, size_t bytes) {
+  static const char zeros[CSC_ALIGN];
+  fwrite(data, 1, bytes, fp);
+  fwrite(zeros, 1, align_up(bytes) - bytes, fp);
+}
+
+int csc_write(const char *name, MKL_INT size, MKL_INT *col_ptr,
+              MKL_INT *row_ind, double *values, int symmetric) {
+  struct csc_header h;
+  char path[PATHLEN];
+  FILE *fp;
+  MKL_INT nnz = col_ptr[size];
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CSC_MAGIC, sizeof(CSC_MAGIC));
+  h.version = CSC_VERSION;
+  h.index_width = sizeof(MKL_INT);
+  h.value_type = CSC_DOUBLE;
+  h.flags = symmetric ? CSC_SYMMETRIC : 0;
+  h.size = size;
+  h.nnz = nnz;
+  h.col_ptr_offset = align_up(sizeof(h));
+  h.row_ind_offset = h.col_ptr_offset + align_up((size+1) * sizeof(MKL_INT));
+  h.values_offset = h.row_ind_offset + align_up(nnz * sizeof(MKL_INT));
+  h.col_ptr_checksum = csc_checksum(col_ptr, (size+1) * sizeof(MKL_INT));
+  h.row_ind_checksum = csc_checksum(row_ind, nnz * sizeof(MKL_INT));
+  h.values_checksum = csc_checksum(values, nnz * sizeof(double));
+  h.header_checksum = header_checksum(&h);
+
+  snprintf(path, PATHLEN, "%s.csc", name);
+  fp = fopen(path, "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "%s: Cannot create file\n", path);
+    return -1;
+  }
+  write_section(fp, &h, sizeof(h));
+  write_section(fp, col_ptr, (size+1) * sizeof(MKL_INT));
+  write_section(fp, row_ind, nnz * sizeof(MKL_INT));
+  fwrite(values, sizeof(double), nnz, fp);
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "%s: Write failed\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int csc_write_triple(const char *name, MKL_INT size, MKL_INT *col_ptr,
+                     MKL_INT *row_ind, double *values) {
+  char path[PATHLEN];
+  FILE *fp;
+
+  snprintf(path, PATHLEN, "%s.val", name);
+  fp = fopen(path, "wb");
+  fwrite(values, sizeof(double), col_ptr[size], fp);
+  fclose(fp);
+  snprintf(path, PATHLEN, "%s.ri", name);
+  fp = fopen(path, "wb");
+  fwrite(row_ind, sizeof(MKL_INT), col_ptr[size], fp);
+  fclose(fp);
+  snprintf(path, PATHLEN, "%s.cp", name);
+  fp = fopen(path, "wb");
+  fwrite(col_ptr, sizeof(MKL_INT), size+1, fp);
+  fclose(fp);
+  return 0;
+}
+
+void csc_close(struct csc_matrix *m) {
+  int i;
+  if (m->owned & 1) {
+    free(m->col_ptr);
+  }
+  if (m->owned & 2) {
+    free(m->row_ind);
+  }
+  if (m->owned & 4) {
+    free(m->values);
+  }
+  for (i = 0; i < 3; i++) {
+    if (m->maps[i]) {
+      munmap(m->maps[i], m->map_lengths[i]);
+    }
+  }
+  memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,83 @@
+#ifndef CSC_IO_H
+#define CSC_IO_H
+
+#include <mkl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A sparse matrix in CSC format as a single file, <name>.csc. The header
+ * describes the contents, so readers don't need to know the size or assume
+ * the index width and value type. Each array starts on a new page, so one
+ * mmap of the file serves all of them without copying. All integers are in
+ * the byte order of the machine that wrote the file. */
+#define CSC_MAGIC "SUBMCSC"
+#define CSC_VERSION 1
+#define CSC_ALIGN 4096
+
+enum csc_value_type {
+  CSC_DOUBLE = 1,
+  CSC_FLOAT  = 2
+};
+
+enum csc_header_flags {
+  CSC_SYMMETRIC = 1
+};
+
+struct csc_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t index_width;     // bytes per entry of col_ptr and row_ind, 4 or 8
+  uint32_t value_type;      // see enum csc_value_type
+  uint32_t flags;           // see enum csc_header_flags
+  uint64_t size;            // number of rows and columns
+  uint64_t nnz;
+  uint64_t col_ptr_offset;  // offsets of the arrays from the file start
+  uint64_t row_ind_offset;
+  uint64_t values_offset;
+  uint64_t col_ptr_checksum; // FNV-1a of the bytes of each array
+  uint64_t row_ind_checksum;
+  uint64_t values_checksum;
+  uint64_t header_checksum;  // FNV-1a of all header bytes before this one
+};
+
+/* Flags for csc_read */
+enum csc_read_flags {
+  CSC_VERIFY   = 1, // check the checksums of the arrays, too
+  CSC_COPY     = 2, // read into malloc'ed arrays owned by the caller
+  CSC_SYMMETRY = 4  // find out whether triple files are symmetric
+};
+
+/* A matrix read by csc_read. Without CSC_COPY the arrays may point into a
+ * mapping of the file and stay valid until csc_close. */
+struct csc_matrix {
+  MKL_INT size;
+  MKL_INT nnz;
+  int symmetric; // -1 if unknown, for triple files read without CSC_SYMMETRY
+  MKL_INT *col_ptr;
+  MKL_INT *row_ind;
+  double *values;
+  void *maps[3];
+  size_t map_lengths[3];
+  int owned; // arrays allocated by csc_read, bit 0..2 as in maps
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t csc_checksum(const void *data, size_t bytes);
+int csc_header_valid(const struct csc_header *h);
+int csc_is_symmetric(MKL_INT size, MKL_INT *col_ptr, MKL_INT *row_ind,
+                     double *values);
+int csc_read(const char *name, int flags, struct csc_matrix *m);
+int csc_write(const char *name, MKL_INT size, MKL_INT *col_ptr,
+              MKL_INT *row_ind, double *values, int symmetric);
+int csc_write_triple(const char *name, MKL_INT size, MKL_INT *col_ptr,
+                     MKL_INT *row_ind, double *values);
+void csc_close(struct csc_matrix *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <mkl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "submatrix.h"
+#include "workspace.h"
+
+/* The largest magnitude among the values, which relative thresholds
+ * refer to */
+double filter_max(MKL_INT nnz, double *values) {
+  double max = .0;
+  MKL_INT k;
+  for (k = 0; k < nnz; k++) {
+    max = fabs(values[k]) > max ? fabs(values[k]) : max;
+  }
+  return max;
+}
+
+/* Drop the entries with magnitude below threshold from the matrix. The
+ * diagonal always stays, every submatrix needs its own column. Rows and
+ * columns have to be numbered alike, as in the global matrix and in a
+ * local one from halo.c. The arrays of the full matrix are only
+ * referenced, not copied. */
+void filter_matrix(MKL_INT size, MKL_INT *col_ptr, MKL_INT *row_ind,
+                   double *values, double threshold, struct filter *f) {
+  MKL_INT i, k, nnz = 0;
+
+  f->size = size;
+  f->threshold = threshold;
+  f->full_col_ptr = col_ptr;
+  f->full_row_ind = row_ind;
+  f->full_values = values;
+  f->col_ptr = (MKL_INT*) calloc(size+1, sizeof(MKL_INT));
+  for (i = 0; i < size; i++) {
+    for (k = col_ptr[i]; k < col_ptr[i+1]; k++) {
+      if (row_ind[k] == i || fabs(values[k]) >= threshold) {
+        nnz++;
+      }
+    }
+    f->col_ptr[i+1] = nnz;
+  }
+  f->row_ind = (MKL_INT*) malloc((nnz ? nnz : 1) * sizeof(MKL_INT));
+  f->values = (double*) malloc((nnz ? nnz : 1) * sizeof(double));
+  f->kept = (MKL_INT*) malloc((nnz ? nnz : 1) * sizeof(MKL_INT));
+  nnz = 0;
+  for (i = 0; i < size; i++) {
+    for (k = col_ptr[i]; k < col_ptr[i+1]; k++) {
+      if (row_ind[k] == i || fabs(values[k]) >= threshold) {
+        f->row_ind[nnz] = row_ind[k];
+        f->values[nnz] = values[k];
+        f->kept[nnz++] = k;
+      }
+    }
+  }
+}
+
+/* Let the submatrices solved with ws take their values from the full
+ * matrix. Only the entries dropped between rows that stay in a pattern make
+ * a difference. */
+void filter_keep_values(struct filter *f, struct workspace *ws, int num) {
+  int t;
+  for (t = 0; t < num; t++) {
+    ws[t].filter = f;
+  }
+}
+
+/* Put the results of the columns first_col to last_col-1, solved with the
+ * filtered matrix and stored back to back in in, into the pattern of the
+ * full matrix in out. Dropped entries are 0 there. */
+void filter_expand(struct filter *f, MKL_INT first_col, MKL_INT last_col,
+                   double *in, double *out) {
+  MKL_INT k, first = f->col_ptr[first_col];
+  MKL_INT full_first = f->full_col_ptr[first_col];
+
+  memset(out, 0, (f->full_col_ptr[last_col] - full_first) * sizeof(double));
+  for (k = first; k < f->col_ptr[last_col]; k++) {
+    out[f->kept[k] - full_first] = in[k - first];
+  }
+}
+
+/* What filtering does to the submatrices: how many entries it dropped, the
+ * dimensions before and after, and the estimated flops of solving one
+ * submatrix per column. */
+void print_filter(int rank, struct filter *f, int keep,
+                  struct solver_options *opts) {
+  MKL_INT i, dim, full_dim, max = 0, full_max = 0;
+  MKL_INT hist[HIST_BINS] = {0}, full_hist[HIST_BINS] = {0};
+  double flops = .0, full_flops = .0;
+  int b, last = 0;
+
+  for (i = 0; i < f->size; i++) {
+    dim = f->col_ptr[i+1] - f->col_ptr[i];
+    full_dim = f->full_col_ptr[i+1] - f->full_col_ptr[i];
+    max = dim > max ? dim : max;
+    full_max = full_dim > full_max ? full_dim : full_max;
+    hist[hist_bin(dim)]++;
+    full_hist[hist_bin(full_dim)]++;
+    flops += submatrix_flops(dim, 1, opts);
+    full_flops += submatrix_flops(full_dim, 1, opts);
+  }
+  for (b = 0; b < HIST_BINS; b++) {
+    if (hist[b] || full_hist[b]) {
+      last = b;
+    }
+  }
+
+  printf("%d: Filtering dropped %d of %d entries below %e from the "
+         "patterns%s.\n", rank, f->full_col_ptr[f->size] - f->col_ptr[f->size],
+         f->full_col_ptr[f->size], f->threshold,
+         keep ? ", their values stay in the submatrices" : "");
+  printf("%d: Submatrix dimension: mean %.1f, max %d instead of %.1f, %d.\n",
+         rank, f->size ? (double)f->col_ptr[f->size] / f->size : 0., max,
+         f->size ? (double)f->full_col_ptr[f->size] / f->size : 0., full_max);
+  printf("%d: Submatrices by dimension, filtered (full):", rank);
+  for (b = 0; b <= last; b++) {
+    printf(" [%d,%d) %d (%d)", 1 << b, 1 << (b+1), hist[b], full_hist[b]);
+  }
+  printf("\n");
+  printf("%d: Estimated %.3f GFLOP instead of %.3f, %.2fx less.\n", rank,
+         flops/1e9, full_flops/1e9, flops > .0 ? full_flops / flops : 1.);
+}
+
+void free_filter(struct filter *f) {
+  free(f->kept);
+  free(f->values);
+  free(f->row_ind);
+  free(f->col_ptr);
+}
@@ -0,0 +1,34 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <mkl.h>
+#include "workspace.h"
+
+struct solver_options;
+
+/* A matrix with the entries below a threshold dropped, see filter_matrix.
+ * Its patterns span the submatrices, the full matrix is kept alongside for
+ * the values with -Z ...:keep and for putting the results back. */
+struct filter {
+  MKL_INT size;
+  double threshold;
+  MKL_INT *col_ptr;
+  MKL_INT *row_ind;
+  double *values;
+  MKL_INT *kept; // position of each entry in the full matrix
+  MKL_INT *full_col_ptr;
+  MKL_INT *full_row_ind;
+  double *full_values;
+};
+
+double filter_max(MKL_INT nnz, double *values);
+void filter_matrix(MKL_INT size, MKL_INT *col_ptr, MKL_INT *row_ind,
+                   double *values, double threshold, struct filter *f);
+void filter_keep_values(struct filter *f, struct workspace *ws, int num);
+void filter_expand(struct filter *f, MKL_INT first_col, MKL_INT last_col,
+                   double *in, double *out);
+void print_filter(int rank, struct filter *f, int keep,
+                  struct solver_options *opts);
+void free_filter(struct filter *f);
+
+#endif
@@ -0,0 +1,440 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mkl.h>
+#include <omp.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "csc_io.h"
+#include "matrix_io.h"
+
+#define PATHLEN 256
+/* Lanczos steps for the extreme eigenvalues, enough for a few digits. Up to
+ * LANCZOS_MAX_STEPS if the residuals are too large for the condition. */
+#define LANCZOS_STEPS 80
+#define LANCZOS_MAX_STEPS 1280
+/* Rows per partial sum, fixed so the result does not depend on the threads */
+#define SUM_BLOCK 4096
+
+/* Where the entries off the diagonal are */
+enum pattern {
+  PATTERN_RANDOM  = 0, // each with the same probability, like sprandsym
+  PATTERN_BANDED  = 1, // all within width of the diagonal
+  PATTERN_ATOMS   = 2, // dense blocks of width basis functions, random between
+  PATTERN_LATTICE = 3  // sites of a cubic lattice, neighbours within width
+};
+
+struct generator {
+  int pattern;
+  long size;
+  double density; // probability of an entry off the diagonal (and blocks)
+  int width;
+  long side;      // of the lattice
+  uint64_t seed;
+};
+
+/* splitmix64, small enough to give every column its own stream */
+static uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t next(uint64_t *state) {
+  *state += 0x9e3779b97f4a7c15ULL;
+  return mix(*state - 0x9e3779b97f4a7c15ULL);
+}
+
+/* Uniform in (0, 1] */
+static double uniform(uint64_t *state) {
+  return ((next(state) >> 11) + 1) * 0x1.0p-53;
+}
+
+/* Rows to skip until the next entry when each is there with probability p */
+static long skip(uint64_t *state, double p) {
+  double gap;
+  if (p >= 1.) {
+    return 0;
+  }
+  gap = std::floor(std::log(uniform(state)) / std::log1p(-p));
+  return gap < 1e18 ? (long) gap : (long) 1e18;
+}
+
+/* Hand add(row) the rows below the diagonal in column j. Each column draws
+ * from its own stream, so the matrix does not depend on the threads. */
+template <typename Add> static void lower_rows(struct generator *g, long j,
+  uint64_t *state, Add add) {
+
+  long n = g->size, i, end;
+  int dx, dy, dz, w = g->width;
+
+  switch (g->pattern) {
+    case PATTERN_BANDED:
+      for (i = j + 1; i < n && i <= j + w; i++) {
+        add(i);
+      }
+      break;
+    case PATTERN_ATOMS:
+      end = (j / w + 1) * w;
+      for (i = j + 1; i < n && i < end; i++) {
+        add(i);
+      }
+      for (i = end + skip(state, g->density); i < n;
+           i += 1 + skip(state, g->density)) {
+        add(i);
+      }
+      break;
+    case PATTERN_LATTICE:
+      /* Site j is at (x, y, z) = (j % side, j / side % side, j / side^2).
+       * Going through the offsets by z, y, x visits the rows in order. */
+      for (dz = 0; dz <= w; dz++) {
+        for (dy = dz ? -w : 0; dy <= w; dy++) {
+          for (dx = dz || dy ? -w : 1; dx <= w; dx++) {
+            long x = j % g->side + dx, y = j / g->side % g->side + dy;
+            long z = j / g->side / g->side + dz;
+            if (dx*dx + dy*dy + dz*dz > w*w || x < 0 || x >= g->side ||
+                y < 0 || y >= g->side) {
+              continue;
+            }
+            i = x + g->side * (y + g->side * z);
+            if (i < n) {
+              add(i);
+            }
+          }
+        }
+      }
+      break;
+    default:
+      for (i = j + 1 + skip(state, g->density); i < n;
+           i += 1 + skip(state, g->density)) {
+        add(i);
+      }
+  }
+}
+
+/* y = A x for the symmetric A, row i is column i */
+static void spmv(long n, MKL_INT *col_ptr, MKL_INT *row_ind, double *values,
+                 double *x, double *y) {
+  long i;
+  #pragma omp parallel for schedule(static)
+  for (i = 0; i < n; i++) {
+    MKL_INT k;
+    double sum = 0.;
+    for (k = col_ptr[i]; k < col_ptr[i+1]; k++) {
+      sum += values[k] * x[row_ind[k]];
+    }
+    y[i] = sum;
+  }
+}
+
+static double dot(long n, double *x, double *y) {
+  long blocks = (n + SUM_BLOCK - 1) / SUM_BLOCK, b;
+  double *part = (double*) malloc((blocks ? blocks : 1) * sizeof(double));
+  double sum = 0.;
+
+  #pragma omp parallel for schedule(static)
+  for (b = 0; b < blocks; b++) {
+    long i, last = (b + 1) * SUM_BLOCK < n ? (b + 1) * SUM_BLOCK : n;
+    part[b] = 0.;
+    for (i = b * SUM_BLOCK; i < last; i++) {
+      part[b] += x[i] * y[i];
+    }
+  }
+  for (b = 0; b < blocks; b++) {
+    sum += part[b];
+  }
+  free(part);
+  return sum;
+}
+
+/* The largest Gershgorin radius of A. With a zero diagonal all eigenvalues
+ * lie within it of 0. */
+static double gershgorin_radius(long n, MKL_INT *col_ptr, MKL_INT *row_ind,
+                                double *values) {
+  double radius = 0.;
+  long j;
+  #pragma omp parallel for schedule(static) reduction(max:radius)
+  for (j = 0; j < n; j++) {
+    MKL_INT k;
+    double sum = 0.;
+    for (k = col_ptr[j]; k < col_ptr[j+1]; k++) {
+      if (row_ind[k] != j) {
+        sum += std::fabs(values[k]);
+      }
+    }
+    radius = sum > radius ? sum : radius;
+  }
+  return radius;
+}
+
+/* Estimate the smallest and largest eigenvalue of A with steps Lanczos
+ * steps. Its
+ * extreme Ritz values converge first and from the inside, so they are
+ * good lower bounds of the spread after a few dozen steps. rmin and rmax
+ * are the residual norms of the two Ritz pairs, how far they may still be
+ * from an eigenvalue. */
+static void extreme_eigenvalues(long n, MKL_INT *col_ptr, MKL_INT *row_ind,
+                                double *values, uint64_t seed, int steps,
+                                double *lmin, double *lmax, double *rmin,
+                                double *rmax) {
+  double *v = (double*) calloc(n, sizeof(double));
+  double *prev = (double*) calloc(n, sizeof(double));
+  double *w = (double*) malloc(n * sizeof(double));
+  double *alpha, *beta, *z, norm, next = 0., *t;
+  lapack_int info;
+  int m;
+  long i;
+
+  steps = n < steps ? n : steps;
+  alpha = (double*) malloc(steps * sizeof(double));
+  beta = (double*) malloc(steps * sizeof(double));
+  z = (double*) malloc((size_t) steps * steps * sizeof(double));
+
+  for (i = 0; i < n; i++) {
+    uint64_t state = mix(seed ^ mix(i));
+    v[i] = uniform(&state) - 0.5;
+  }
+  norm = std::sqrt(dot(n, v, v));
+  for (i = 0; i < n; i++) {
+    v[i] /= norm;
+  }
+  beta[0] = 0.;
+  for (m = 0; m < steps; ) {
+    spmv(n, col_ptr, row_ind, values, v, w);
+    alpha[m] = dot(n, w, v);
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < n; i++) {
+      w[i] -= alpha[m] * v[i] + beta[m] * prev[i];
+    }
+    m++;
+    next = std::sqrt(dot(n, w, w));
+    if (m == steps) {
+      break;
+    }
+    if (next <= 1e-12 * std::fabs(alpha[m-1])) {
+      break; // an invariant subspace, its Ritz values are exact
+    }
+    beta[m] = next;
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < n; i++) {
+      w[i] /= beta[m];
+    }
+    t = prev;
+    prev = v;
+    v = w;
+    w = t;
+  }
+
+  /* Eigenvalues of the tridiagonal matrix in ascending order. The residual
+   * of a Ritz pair is next times the last entry of its eigenvector. */
+  info = LAPACKE_dstev(LAPACK_COL_MAJOR, 'V', m, alpha, beta + 1, z, m);
+  if (info != 0) {
+    fprintf(stderr, "Eigenvalues of the Lanczos matrix failed (info %d)\n",
+            (int) info);
+    exit(EXIT_FAILURE);
+  }
+  *lmin = m ? alpha[0] : 0.;
+  *lmax = m ? alpha[m-1] : 0.;
+  *rmin = m ? next * std::fabs(z[m-1]) : 0.;
+  *rmax = m ? next * std::fabs(z[(m-1) + (m-1)*m]) : 0.;
+  free(z);
+  free(beta);
+  free(alpha);
+  free(v);
+  free(prev);
+  free(w);
+}
+
+/* Generate one matrix in CSC. The pattern is symmetric with the diagonal
+ * always in it, the entries off the diagonal are uniform in [-1, 1]. The
+ * diagonal is then shifted so the extreme eigenvalues have the requested
+ * ratio. Returns the condition number this gives according to the Ritz
+ * values, only an estimate. */
+static double generate(struct generator *g, double condition,
+                       MKL_INT **col_ptr, MKL_INT **row_ind,
+                       double **values) {
+  int threads = omp_get_max_threads(), steps;
+  struct triplet **found;
+  long *count, j, n = g->size;
+  double lmin, lmax, rmin, rmax, radius, low, high, shift;
+
+  found = (struct triplet**) calloc(threads, sizeof(struct triplet*));
+  count = (long*) calloc(threads, sizeof(long));
+  #pragma omp parallel num_threads(threads)
+  {
+    int me = omp_get_thread_num();
+    long capacity = 0, jj;
+    #pragma omp for schedule(static)
+    for (jj = 0; jj < n; jj++) {
+      uint64_t state = mix(g->seed ^ mix(jj));
+      add_triplet(&(found[me]), &(count[me]), &capacity, jj, jj, 0.);
+      lower_rows(g, jj, &state, [&](long i) {
+        add_triplet(&(found[me]), &(count[me]), &capacity, i, jj,
+                    2. * uniform(&state) - 1.);
+      });
+    }
+  }
+  // Every entry below the diagonal also stands for the one above it
+  triplets_to_csc(found, count, threads, n, 1, col_ptr, row_ind, values);
+  free(found);
+  free(count);
+
+  /* Shifting by s moves all eigenvalues by s, the condition number becomes
+   * (lmax + s) / (lmin + s). The Ritz values lie inside the spectrum, so
+   * the shift is taken from low and high, which are widened by the
+   * residuals. That is still an estimate: a residual only says that some
+   * eigenvalue is that close, and if Lanczos missed the extreme one it can
+   * be further out. Only the Gershgorin bounds always hold, so the margin
+   * never goes past them. More steps are taken while the margin is not
+   * small against the smallest eigenvalue after the shift. */
+  for (steps = LANCZOS_STEPS; ; steps *= 2) {
+    extreme_eigenvalues(n, *col_ptr, *row_ind, *values, mix(g->seed), steps,
+                        &lmin, &lmax, &rmin, &rmax);
+    if (10. * rmin <= (lmax - lmin) / (condition - 1.) || steps >= n ||
+        2 * steps > LANCZOS_MAX_STEPS) {
+      break;
+    }
+  }
+  radius = gershgorin_radius(n, *col_ptr, *row_ind, *values);
+  low = lmin - rmin > -radius ? lmin - rmin : -radius;
+  high = lmax + rmax < radius ? lmax + rmax : radius;
+  shift = high > low ? (high - condition * low) / (condition - 1.) :
+                       1. - low;
+  #pragma omp parallel for schedule(static)
+  for (j = 0; j < n; j++) {
+    MKL_INT k;
+    for (k = (*col_ptr)[j]; k < (*col_ptr)[j+1]; k++) {
+      if ((*row_ind)[k] == j) {
+        (*values)[k] = shift;
+      }
+    }
+  }
+  return (lmax + shift) / (lmin + shift);
+}
+
+int main(int argc, char* argv[]) {
+
+  struct generator g;
+  MKL_INT *col_ptr, *row_ind;
+  double *values, scale = 100., achieved, tStart;
+  char name[PATHLEN];
+  int triple = 0, reps = 3, first = 1, density, condition, opt, rep, ret;
+  uint64_t seed = 1;
+
+  g.pattern = PATTERN_RANDOM;
+  g.width = 0;
+  while ((opt = getopt(argc, argv, "tk:w:x:r:n:s:")) != -1) {
+    switch (opt) {
+      case 't':
+        // write the old .val/.ri/.cp files instead of the container
+        triple = 1;
+        break;
+      case 'k':
+        if (strcmp(optarg, "random") == 0) {
+          g.pattern = PATTERN_RANDOM;
+        } else if (strcmp(optarg, "banded") == 0) {
+          g.pattern = PATTERN_BANDED;
+        } else if (strcmp(optarg, "atoms") == 0) {
+          g.pattern = PATTERN_ATOMS;
+        } else if (strcmp(optarg, "lattice") == 0) {
+          g.pattern = PATTERN_LATTICE;
+        } else {
+          argc = 0;
+        }
+        break;
+      case 'w':
+        g.width = strtol(optarg, NULL, 10);
+        break;
+      case 'x':
+        scale = strtod(optarg, NULL);
+        break;
+      case 'r':
+        reps = strtol(optarg, NULL, 10);
+        break;
+      case 'n':
+        first = strtol(optarg, NULL, 10);
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        argc = 0;
+    }
+  }
+  if (argc - optind != 3) {
+    fprintf(stderr,
+      "Usage: ./generate-matrix [-t] [-k random|banded|atoms|lattice] "
+      "[-w width] [-x scale] [-r reps] [-n first] [-s seed] size density "
+      "condition\n"
+      "  Writes sprandsym-s<size>-d<density>-c<condition>-n<first..>, reps\n"
+      "  of them (default 3). The density is divided by scale, 100 by\n"
+      "  default as in generate-small.m, generate-large.m used 100000000.\n"
+      "  For banded matrices width is the half bandwidth (from the density\n"
+      "  if not given), for atoms the basis functions per atom (6), for the\n"
+      "  lattice the cutoff radius in sites (1).\n");
+    exit(EXIT_FAILURE);
+  }
+  g.size = strtol(argv[optind], NULL, 10);
+  density = strtol(argv[optind+1], NULL, 10);
+  condition = strtol(argv[optind+2], NULL, 10);
+  g.density = density / scale;
+  if (g.size <= 0 || condition <= 1 || g.density < 0. || g.density > 1.) {
+    fprintf(stderr, "Need size > 0, condition > 1 and density / scale in "
+            "[0, 1]\n");
+    exit(EXIT_FAILURE);
+  }
+  if (g.width <= 0) {
+    g.width = g.pattern == PATTERN_ATOMS ? 6 : g.pattern == PATTERN_LATTICE ?
+              1 : (int) std::lround(g.density * (g.size - 1) / 2.);
+    g.width = g.width > 0 ? g.width : 1;
+  }
+  for (g.side = 1; g.side * g.side * g.side < g.size; g.side++);
+
+  for (rep = first; rep < first + reps; rep++) {
+    tStart = omp_get_wtime();
+    g.seed = mix(seed ^ mix(rep));
+    achieved = generate(&g, condition, &col_ptr, &row_ind, &values);
+    snprintf(name, PATHLEN, "sprandsym-s%ld-d%d-c%d-n%d", g.size, density,
+             condition, rep);
+    if (triple) {
+      ret = csc_write_triple(name, g.size, col_ptr, row_ind, values);
+    } else {
+      ret = csc_write(name, g.size, col_ptr, row_ind, values, 1);
+    }
+    if (ret != 0) {
+      exit(EXIT_FAILURE);
+    }
+    printf("%s: %ld nonzeros, condition ~%.4g (estimate), %.2f s\n", name,
+           (long) col_ptr[g.size], achieved, omp_get_wtime() - tStart);
+    free(row_ind);
+    free(values);
+    free(col_ptr);
+  }
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,219 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "group.h"
+#include "partition.h"
+
+struct column_hash {
+  unsigned long hash;
+  MKL_INT col;
+};
+
+static int compare_hash(const void *a, const void *b) {
+  const struct column_hash *x = (const struct column_hash*) a;
+  const struct column_hash *y = (const struct column_hash*) b;
+  if (x->hash != y->hash) {
+    return x->hash < y->hash ? -1 : 1;
+  }
+  return x->col < y->col ? -1 : (x->col > y->col);
+}
+
+// FNV-1a over the row indices of column i
+static unsigned long hash_column(MKL_INT *row_ind, MKL_INT *col_ptr,
+                                 MKL_INT i) {
+  unsigned long hash = 14695981039346656037UL;
+  MKL_INT p;
+  for (p = col_ptr[i]; p < col_ptr[i+1]; p++) {
+    hash ^= (unsigned long) row_ind[p];
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+static int same_pattern(MKL_INT *row_ind, MKL_INT *col_ptr, MKL_INT i,
+                        MKL_INT j) {
+  MKL_INT nnz = col_ptr[i+1] - col_ptr[i];
+  return nnz == col_ptr[j+1] - col_ptr[j] &&
+         memcmp(&(row_ind[col_ptr[i]]), &(row_ind[col_ptr[j]]),
+                nnz*sizeof(MKL_INT)) == 0;
+}
+
+// Size of the union of two sorted index lists, written to out if not NULL
+static MKL_INT merge_patterns(MKL_INT *a, MKL_INT na, MKL_INT *b, MKL_INT nb,
+                              MKL_INT *out) {
+  MKL_INT i = 0, j = 0, n = 0, v;
+  while (i < na || j < nb) {
+    if (j == nb || (i < na && a[i] < b[j])) {
+      v = a[i++];
+    } else if (i == na || b[j] < a[i]) {
+      v = b[j++];
+    } else {
+      v = a[i++];
+      j++;
+    }
+    if (out) {
+      out[n] = v;
+    }
+    n++;
+  }
+  return n;
+}
+
+/* Group the columns first_col to last_col-1 so that one submatrix serves all
+ * members of a group. Columns with identical patterns are found by hashing.
+ * Afterwards neighbouring groups are merged if one pattern contains the
+ * other, or if the union is at most growth percent larger than the longest
+ * column in the group and a single submatrix over the union is estimated to
+ * be cheaper than two separate ones. A negative growth only groups identical
+ * patterns. */
+void group_columns(MKL_INT *row_ind, MKL_INT *col_ptr, MKL_INT first_col,
+                   MKL_INT last_col, int growth, struct column_groups *groups) {
+  struct column_hash *hashes;
+  MKL_INT n, c, d, g, rep, *group_of, *order, *first_member, *member_count,
+          num_identical, u, cur, cur_len, cur_max, len, *cur_pattern, *tmp,
+          *merged;
+
+  n = last_col - first_col;
+  hashes = (struct column_hash*) malloc(n * sizeof(struct column_hash));
+  for (c = 0; c < n; c++) {
+    hashes[c].hash = hash_column(row_ind, col_ptr, first_col + c);
+    hashes[c].col = first_col + c;
+  }
+  qsort(hashes, n, sizeof(struct column_hash), compare_hash);
+
+  // Identical patterns: within each run of equal hashes compare for real
+  group_of = (MKL_INT*) malloc(n * sizeof(MKL_INT));
+  for (c = 0; c < n; c++) {
+    group_of[hashes[c].col - first_col] = -1;
+  }
+  for (c = 0; c < n; c++) {
+    if (group_of[hashes[c].col - first_col] != -1) {
+      continue;
+    }
+    rep = hashes[c].col;
+    group_of[rep - first_col] = rep - first_col;
+    for (d = c+1; d < n && hashes[d].hash == hashes[c].hash; d++) {
+      if (group_of[hashes[d].col - first_col] == -1 &&
+          same_pattern(row_ind, col_ptr, rep, hashes[d].col)) {
+        group_of[hashes[d].col - first_col] = rep - first_col;
+      }
+    }
+  }
+  free(hashes);
+
+  // Number the groups by their first column, which is their representative
+  order = (MKL_INT*) malloc(n * sizeof(MKL_INT));
+  first_member = (MKL_INT*) malloc(n * sizeof(MKL_INT));
+  member_count = (MKL_INT*) calloc(n, sizeof(MKL_INT));
+  num_identical = 0;
+  for (c = 0; c < n; c++) {
+    if (group_of[c] == c) {
+      order[c] = num_identical;
+      first_member[num_identical++] = c;
+    }
+    member_count[order[group_of[c]]]++;
+  }
+
+  /* Merge neighbouring groups. merged[g] is the group of the result that
+   * identical group g ends up in. */
+  groups->member_ptr = (MKL_INT*) calloc(num_identical+1, sizeof(MKL_INT));
+  groups->pattern_ptr = (MKL_INT*) calloc(num_identical+1, sizeof(MKL_INT));
+  groups->patterns = (MKL_INT*) malloc((col_ptr[last_col] - col_ptr[first_col])
+                                       * sizeof(MKL_INT));
+  groups->members = (MKL_INT*) malloc(n * sizeof(MKL_INT));
+  tmp = (MKL_INT*) malloc(n * sizeof(MKL_INT));
+  // A union never has more entries than all columns of the range together
+  merged = (MKL_INT*) malloc((col_ptr[last_col] - col_ptr[first_col])
+                             * sizeof(MKL_INT));
+  cur = -1;
+  cur_len = 0;
+  cur_max = 0;
+  cur_pattern = NULL;
+  for (g = 0; g < num_identical; g++) {
+    rep = first_col + first_member[g];
+    len = col_ptr[rep+1] - col_ptr[rep];
+    if (cur >= 0 && growth >= 0) {
+      u = merge_patterns(cur_pattern, cur_len, &(row_ind[col_ptr[rep]]), len,
+                         NULL);
+      if (u == cur_len || u == len ||
+          (100*u <= (100+growth) * (cur_max > len ? cur_max : len) &&
+           submatrix_cost(u) <= submatrix_cost(cur_len) +
+                                submatrix_cost(len))) {
+        merge_patterns(cur_pattern, cur_len, &(row_ind[col_ptr[rep]]), len,
+                       merged);
+        memcpy(cur_pattern, merged, u * sizeof(MKL_INT));
+        cur_len = u;
+        if (len > cur_max) {
+          cur_max = len;
+        }
+        groups->pattern_ptr[cur+1] = groups->pattern_ptr[cur] + u;
+        groups->member_ptr[cur+1] += member_count[g];
+        order[g] = cur;
+        continue;
+      }
+    }
+    // Start a new group
+    cur++;
+    cur_pattern = &(groups->patterns[groups->pattern_ptr[cur]]);
+    memcpy(cur_pattern, &(row_ind[col_ptr[rep]]), len * sizeof(MKL_INT));
+    cur_len = len;
+    cur_max = len;
+    groups->pattern_ptr[cur+1] = groups->pattern_ptr[cur] + len;
+    groups->member_ptr[cur+1] = groups->member_ptr[cur] + member_count[g];
+    order[g] = cur;
+  }
+  groups->num_groups = cur+1;
+
+  /* order now maps identical groups to merged ones. Fill in the members in
+   * column order. */
+  for (c = 0; c < n; c++) {
+    member_count[c] = -1;
+  }
+  for (g = 0, c = 0; c < n; c++) {
+    if (group_of[c] == c) {
+      member_count[c] = order[g++];
+    }
+  }
+  memset(tmp, 0, n * sizeof(MKL_INT));
+  for (c = 0; c < n; c++) {
+    g = member_count[group_of[c]];
+    groups->members[groups->member_ptr[g] + tmp[g]++] = first_col + c;
+  }
+
+  free(merged);
+  free(tmp);
+  free(member_count);
+  free(first_member);
+  free(order);
+  free(group_of);
+}
+
+void free_column_groups(struct column_groups *groups) {
+  free(groups->patterns);
+  free(groups->pattern_ptr);
+  free(groups->members);
+  free(groups->member_ptr);
+}
@@ -0,0 +1,22 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <mkl.h>
+
+/* Columns that share one submatrix. Group g is spanned by the rows
+ * patterns[pattern_ptr[g]] to patterns[pattern_ptr[g+1]-1] and serves the
+ * columns members[member_ptr[g]] to members[member_ptr[g+1]-1]. The pattern
+ * of every member is a subset of the pattern of its group. */
+struct column_groups {
+  MKL_INT num_groups;
+  MKL_INT *member_ptr;
+  MKL_INT *members;
+  MKL_INT *pattern_ptr;
+  MKL_INT *patterns;
+};
+
+void group_columns(MKL_INT *row_ind, MKL_INT *col_ptr, MKL_INT first_col,
+                   MKL_INT last_col, int growth, struct column_groups *groups);
+void free_column_groups(struct column_groups *groups);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mkl.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "halo.h"
+#include "submatrix.h"
+
+static int compare_index(const void *a, const void *b) {
+  MKL_INT x = *(const MKL_INT*)a, y = *(const MKL_INT*)b;
+  return (x > y) - (x < y);
+}
+
+/* Collect the sorted union of the patterns of the columns first_col to
+ * last_col-1. These are all columns their submatrices are built from, and
+ * all rows of them that are needed. Returns the number of columns. */
+MKL_INT find_halo(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT first_col,
+                  MKL_INT last_col, MKL_INT **cols) {
+  MKL_INT i, num, total = col_ptr[last_col] - col_ptr[first_col];
+
+  *cols = (MKL_INT*) malloc((total ? total : 1) * sizeof(MKL_INT));
+  memcpy(*cols, &(row_ind[col_ptr[first_col]]), total * sizeof(MKL_INT));
+  qsort(*cols, total, sizeof(MKL_INT), compare_index);
+  for (i = 0, num = 0; i < total; i++) {
+    if (num == 0 || (*cols)[i] != (*cols)[num-1]) {
+      (*cols)[num++] = (*cols)[i];
+    }
+  }
+  return num;
+}
+
+MKL_INT global_to_local(struct local_matrix *local, MKL_INT col) {
+  if (local->size == 0) {
+    return -1;
+  }
+  return find_elem(col, local->cols, local->size);
+}
+
+/* Fill in the local matrix from the halo columns in local->cols. The rows
+ * of local column j are row_ind[col_start[j]] to row_ind[col_end[j]-1], the
+ * worker's own columns are the global columns first_col to last_col-1. Rows
+ * outside the halo are dropped: a submatrix only ever takes rows of its own
+ * pattern, which lies inside. */
+void build_local(struct local_matrix *local, MKL_INT *col_start,
+                 MKL_INT *col_end, MKL_INT *row_ind, double *values,
+                 MKL_INT first_col, MKL_INT last_col) {
+  MKL_INT j, p, k, nnz;
+
+  // Both the halo and the rows of every column are sorted, so one merge per
+  // column finds the rows to keep and their local index
+  nnz = 0;
+  for (j = 0; j < local->size; j++) {
+    for (p = col_start[j], k = 0; p < col_end[j] && k < local->size;) {
+      if (row_ind[p] < local->cols[k]) {
+        p++;
+      } else if (row_ind[p] > local->cols[k]) {
+        k++;
+      } else {
+        nnz++;
+        p++;
+        k++;
+      }
+    }
+  }
+
+  local->col_ptr = (MKL_INT*) malloc((local->size+1) * sizeof(MKL_INT));
+  local->row_ind = (MKL_INT*) malloc((nnz ? nnz : 1) * sizeof(MKL_INT));
+  local->values = (double*) malloc((nnz ? nnz : 1) * sizeof(double));
+  local->col_ptr[0] = 0;
+  nnz = 0;
+  for (j = 0; j < local->size; j++) {
+    for (p = col_start[j], k = 0; p < col_end[j] && k < local->size;) {
+      if (row_ind[p] < local->cols[k]) {
+        p++;
+      } else if (row_ind[p] > local->cols[k]) {
+        k++;
+      } else {
+        local->row_ind[nnz] = k;
+        local->values[nnz] = values[p];
+        nnz++;
+        p++;
+        k++;
+      }
+    }
+    local->col_ptr[j+1] = nnz;
+  }
+
+  // Every column is part of its own pattern, so our columns are contiguous
+  local->first_col = first_col < last_col ?
+                     global_to_local(local, first_col) : 0;
+  local->last_col = local->first_col + (last_col - first_col);
+}
+
+/* Build the local matrix of a worker that solves the columns first_col to
+ * last_col-1 of the global matrix. */
+void extract_local(MKL_INT *col_ptr, MKL_INT *row_ind, double *values,
+                   MKL_INT first_col, MKL_INT last_col,
+                   struct local_matrix *local) {
+  MKL_INT j, *col_start, *col_end;
+
+  local->size = find_halo(col_ptr, row_ind, first_col, last_col,
+                          &(local->cols));
+  col_start = (MKL_INT*) malloc((local->size ? local->size : 1) *
+                                sizeof(MKL_INT));
+  col_end = (MKL_INT*) malloc((local->size ? local->size : 1) *
+                              sizeof(MKL_INT));
+  for (j = 0; j < local->size; j++) {
+    col_start[j] = col_ptr[local->cols[j]];
+    col_end[j] = col_ptr[local->cols[j]+1];
+  }
+  build_local(local, col_start, col_end, row_ind, values, first_col,
+              last_col);
+  free(col_end);
+  free(col_start);
+}
+
+void send_local(struct local_matrix *local, int dest, MPI_Comm comm) {
+  MKL_INT header[4];
+
+  header[0] = local->size;
+  header[1] = local->first_col;
+  header[2] = local->last_col;
+  header[3] = local->col_ptr[local->size];
+  MPI_Send(header, 4, MPI_INT, dest, 0, comm);
+  MPI_Send(local->cols, local->size, MPI_INT, dest, 0, comm);
+  MPI_Send(local->col_ptr, local->size+1, MPI_INT, dest, 0, comm);
+  MPI_Send(local->row_ind, header[3], MPI_INT, dest, 0, comm);
+  MPI_Send(local->values, header[3], MPI_DOUBLE, dest, 0, comm);
+}
+
+/* Send worker p (rank p+1) the local matrix for the columns bounds[p] to
+ * bounds[p+1]-1. The workers are served one after the other, so only one
+ * local matrix exists at a time. */
+void send_halos(MKL_INT *col_ptr, MKL_INT *row_ind, double *values,
+                MKL_INT size, MKL_INT *bounds, int parts, MPI_Comm comm) {
+  struct local_matrix local;
+  double sent = .0, broadcast = (double)parts * col_ptr[size];
+  int p;
+
+  for (p = 0; p < parts; p++) {
+    extract_local(col_ptr, row_ind, values, bounds[p], bounds[p+1], &local);
+    send_local(&local, p+1, comm);
+    printf("0: Worker %d gets a halo of %d of %d columns with %d of %d "
+           "nonzeros.\n", p+1, local.size, size, local.col_ptr[local.size],
+           col_ptr[size]);
+    sent += local.col_ptr[local.size];
+    free_local(&local);
+  }
+  printf("0: Sent %.0f nonzeros in total instead of %.0f for broadcasting "
+         "the matrix (%.2fx less).\n", sent, broadcast,
+         sent > .0 ? broadcast / sent : 1.);
+}
+
+void recv_local(struct local_matrix *local, int source, MPI_Comm comm) {
+  MKL_INT header[4];
+
+  MPI_Recv(header, 4, MPI_INT, source, 0, comm, MPI_STATUS_IGNORE);
+  local->size = header[0];
+  local->first_col = header[1];
+  local->last_col = header[2];
+  local->cols = (MKL_INT*) malloc((local->size ? local->size : 1) *
+                                  sizeof(MKL_INT));
+  local->col_ptr = (MKL_INT*) malloc((local->size+1) * sizeof(MKL_INT));
+  local->row_ind = (MKL_INT*) malloc((header[3] ? header[3] : 1) *
+                                     sizeof(MKL_INT));
+  local->values = (double*) malloc((header[3] ? header[3] : 1) *
+                                   sizeof(double));
+  MPI_Recv(local->cols, local->size, MPI_INT, source, 0, comm,
+           MPI_STATUS_IGNORE);
+  MPI_Recv(local->col_ptr, local->size+1, MPI_INT, source, 0, comm,
+           MPI_STATUS_IGNORE);
+  MPI_Recv(local->row_ind, header[3], MPI_INT, source, 0, comm,
+           MPI_STATUS_IGNORE);
+  MPI_Recv(local->values, header[3], MPI_DOUBLE, source, 0, comm,
+           MPI_STATUS_IGNORE);
+}
+
+void free_local(struct local_matrix *local) {
+  free(local->cols);
+  free(local->col_ptr);
+  free(local->row_ind);
+  free(local->values);
+}
@@ -0,0 +1,37 @@
+#ifndef HALO_H
+#define HALO_H
+
+#include <mkl.h>
+#include <mpi.h>
+
+/* The part of the matrix one worker needs for its columns: the columns its
+ * submatrices touch (the halo), restricted to the same rows and renumbered
+ * 0..size-1 in order. cols maps local to global indices and, being sorted,
+ * global to local ones through global_to_local. The worker's own columns
+ * are the local columns first_col to last_col-1. */
+struct local_matrix {
+  MKL_INT size;
+  MKL_INT first_col;
+  MKL_INT last_col;
+  MKL_INT *cols;
+  MKL_INT *col_ptr;
+  MKL_INT *row_ind;
+  double *values;
+};
+
+MKL_INT find_halo(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT first_col,
+                  MKL_INT last_col, MKL_INT **cols);
+MKL_INT global_to_local(struct local_matrix *local, MKL_INT col);
+void build_local(struct local_matrix *local, MKL_INT *col_start,
+                 MKL_INT *col_end, MKL_INT *row_ind, double *values,
+                 MKL_INT first_col, MKL_INT last_col);
+void extract_local(MKL_INT *col_ptr, MKL_INT *row_ind, double *values,
+                   MKL_INT first_col, MKL_INT last_col,
+                   struct local_matrix *local);
+void send_local(struct local_matrix *local, int dest, MPI_Comm comm);
+void send_halos(MKL_INT *col_ptr, MKL_INT *row_ind, double *values,
+                MKL_INT size, MKL_INT *bounds, int parts, MPI_Comm comm);
+void recv_local(struct local_matrix *local, int source, MPI_Comm comm);
+void free_local(struct local_matrix *local);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "incremental.h"
+
+/* Results can only be reused for the same sparsity pattern and the same
+ * range of columns. */
+int can_update(struct previous_job *prev, MKL_INT size, MKL_INT *col_ptr,
+               MKL_INT *row_ind, MKL_INT first_col, MKL_INT last_col) {
+  return prev->values_inv != NULL && prev->size == size &&
+         prev->first_col == first_col && prev->last_col == last_col &&
+         memcmp(prev->col_ptr, col_ptr, (size+1)*sizeof(MKL_INT)) == 0 &&
+         memcmp(prev->row_ind, row_ind, col_ptr[size]*sizeof(MKL_INT)) == 0;
+}
+
+/* The submatrix of column i is built from the columns in its pattern, so it
+ * has to be solved again as soon as one value in any of these columns changed
+ * by more than tol. Collect those columns of our range in dirty and return
+ * how many there are.
+ *
+ * prev->values are the values the cached results were computed from. Only
+ * the columns that changed by more than tol take over the new values, all
+ * columns that use them are dirty. The dirty columns have to be solved from
+ * prev->values as well, so that small changes cannot add up over many jobs
+ * unnoticed. */
+MKL_INT find_dirty_columns(struct previous_job *prev, double *values,
+                           double tol, MKL_INT *dirty) {
+  MKL_INT i, p, num_dirty, *col_ptr, *row_ind;
+  char *changed;
+
+  col_ptr = prev->col_ptr;
+  row_ind = prev->row_ind;
+  changed = (char*) calloc(prev->size, sizeof(char));
+
+  #pragma omp parallel for private(p) schedule(static)
+  for (i = 0; i < prev->size; i++) {
+    for (p = col_ptr[i]; p < col_ptr[i+1]; p++) {
+      if (fabs(values[p] - prev->values[p]) > tol) {
+        changed[i] = 1;
+        break;
+      }
+    }
+  }
+
+  #pragma omp parallel for schedule(static)
+  for (i = 0; i < prev->size; i++) {
+    if (changed[i]) {
+      memcpy(&(prev->values[col_ptr[i]]), &(values[col_ptr[i]]),
+             (col_ptr[i+1] - col_ptr[i])*sizeof(double));
+    }
+  }
+
+  num_dirty = 0;
+  for (i = prev->first_col; i < prev->last_col; i++) {
+    for (p = col_ptr[i]; p < col_ptr[i+1]; p++) {
+      if (changed[row_ind[p]]) {
+        dirty[num_dirty++] = i;
+        break;
+      }
+    }
+  }
+
+  free(changed);
+  return num_dirty;
+}
+
+/* Keep a copy of the input and take over values_inv for the next job. After
+ * an incremental update values are prev->values, which are kept as they
+ * are. */
+void remember_job(struct previous_job *prev, MKL_INT size, MKL_INT *col_ptr,
+                  MKL_INT *row_ind, double *values, MKL_INT first_col,
+                  MKL_INT last_col, double *values_inv) {
+  if (values == prev->values) {
+    prev->values_inv = values_inv;
+    return;
+  }
+  forget_job(prev);
+  prev->size = size;
+  prev->first_col = first_col;
+  prev->last_col = last_col;
+  prev->col_ptr = (MKL_INT*) malloc((size+1)*sizeof(MKL_INT));
+  prev->row_ind = (MKL_INT*) malloc(col_ptr[size]*sizeof(MKL_INT));
+  prev->values = (double*) malloc(col_ptr[size]*sizeof(double));
+  memcpy(prev->col_ptr, col_ptr, (size+1)*sizeof(MKL_INT));
+  memcpy(prev->row_ind, row_ind, col_ptr[size]*sizeof(MKL_INT));
+  memcpy(prev->values, values, col_ptr[size]*sizeof(double));
+  prev->values_inv = values_inv;
+}
+
+void forget_job(struct previous_job *prev) {
+  free(prev->values_inv);
+  free(prev->values);
+  free(prev->row_ind);
+  free(prev->col_ptr);
+  memset(prev, 0, sizeof(struct previous_job));
+}
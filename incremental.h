@@ -0,0 +1,27 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <mkl.h>
+
+/* What a worker keeps from its previous job to update the results
+ * incrementally when the next matrix only differs in its values. */
+struct previous_job {
+  MKL_INT size;
+  MKL_INT first_col;
+  MKL_INT last_col;
+  MKL_INT *col_ptr;
+  MKL_INT *row_ind;
+  double *values; // the input the results were computed from
+  double *values_inv; // results for the columns first_col to last_col-1
+};
+
+int can_update(struct previous_job *prev, MKL_INT size, MKL_INT *col_ptr,
+               MKL_INT *row_ind, MKL_INT first_col, MKL_INT last_col);
+MKL_INT find_dirty_columns(struct previous_job *prev, double *values,
+                           double tol, MKL_INT *dirty);
+void remember_job(struct previous_job *prev, MKL_INT size, MKL_INT *col_ptr,
+                  MKL_INT *row_ind, double *values, MKL_INT first_col,
+                  MKL_INT last_col, double *values_inv);
+void forget_job(struct previous_job *prev);
+
+#endif
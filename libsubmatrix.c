@@ -0,0 +1,232 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mkl.h>
+#include <mpi.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libsubmatrix.h"
+#include "partition.h"
+#include "solve.h"
+#include "submatrix.h"
+#include "workspace.h"
+
+struct submatrix_context {
+  MPI_Comm comm;
+  int rank;
+  int ranks;
+  struct solver_options opts;
+  // Workspaces of the threads, they grow with the submatrices
+  struct workspace *ws;
+  int threads;
+  // The pattern of the last call and its partition, rank r solves the
+  // columns bounds[r] to bounds[r+1]-1
+  MKL_INT size;
+  MKL_INT nnz;
+  MKL_INT *col_ptr;
+  MKL_INT *row_ind;
+  MKL_INT *bounds;
+  int *counts;
+  int *displs;
+  // Values and results on the ranks other than 0, which uses the caller's
+  // buffers
+  double *values;
+  double *local_inv;
+  struct solve_stats stats;
+};
+
+/* The defaults of mpi-matrix-inv: the plain inverse with LU, merged
+ * assembly, no grouping or batching, large submatrices picked per call. */
+void submatrix_default_options(struct solver_options *opts) {
+  memset(opts, 0, sizeof(*opts));
+  opts->assembly = ASSEMBLY_MERGE;
+  opts->method = SOLVER_LU;
+  opts->p = 1;
+  opts->group = 0;
+  opts->group_growth = -1;
+  opts->batch_max_dim = 0;
+  opts->large_dim = -1;
+  opts->precision = PRECISION_DOUBLE;
+}
+
+/* Set up a context for solving on comm, with the options of rank 0. Like
+ * mpi-matrix-inv, p > 1 takes the eigendecomposition, mixed precision
+ * falls back to double for the methods that do not support it and batching
+ * is left out with mixed precision. */
+struct submatrix_context *submatrix_init(MPI_Comm comm,
+                                         struct solver_options *opts) {
+  struct submatrix_context *ctx;
+
+  ctx = (struct submatrix_context*) calloc(1, sizeof(*ctx));
+  MPI_Comm_dup(comm, &ctx->comm);
+  MPI_Comm_rank(ctx->comm, &ctx->rank);
+  MPI_Comm_size(ctx->comm, &ctx->ranks);
+  ctx->opts = *opts;
+  MPI_Bcast(&ctx->opts, sizeof(ctx->opts), MPI_BYTE, 0, ctx->comm);
+  if (ctx->opts.p > 1) {
+    ctx->opts.method = SOLVER_EIGEN;
+  }
+  if (ctx->opts.precision == PRECISION_MIXED &&
+      ctx->opts.method != SOLVER_LU && ctx->opts.method != SOLVER_CHOLESKY) {
+    ctx->opts.precision = PRECISION_DOUBLE;
+  }
+  if (ctx->opts.precision != PRECISION_DOUBLE) {
+    ctx->opts.batch_max_dim = 0;
+  }
+  ctx->bounds = (MKL_INT*) calloc(ctx->ranks + 1, sizeof(MKL_INT));
+  ctx->counts = (int*) calloc(ctx->ranks, sizeof(int));
+  ctx->displs = (int*) calloc(ctx->ranks, sizeof(int));
+  return ctx;
+}
+
+/* Take a new pattern from rank 0, which also decides whether it changed.
+ * Every rank computes the same partition from it. */
+static void update_pattern(struct submatrix_context *ctx, MKL_INT size,
+                           MKL_INT *col_ptr, MKL_INT *row_ind) {
+  int r;
+
+  free(ctx->col_ptr);
+  free(ctx->row_ind);
+  free(ctx->values);
+  free(ctx->local_inv);
+  ctx->values = NULL;
+  ctx->local_inv = NULL;
+  ctx->col_ptr = (MKL_INT*) malloc((ctx->size + 1) * sizeof(MKL_INT));
+  ctx->row_ind = (MKL_INT*) malloc((ctx->nnz ? ctx->nnz : 1) *
+                                   sizeof(MKL_INT));
+  if (ctx->rank == 0) {
+    memcpy(ctx->col_ptr, col_ptr, (size + 1) * sizeof(MKL_INT));
+    memcpy(ctx->row_ind, row_ind, ctx->nnz * sizeof(MKL_INT));
+  }
+  MPI_Bcast(ctx->col_ptr, ctx->size + 1, MPI_INT, 0, ctx->comm);
+  MPI_Bcast(ctx->row_ind, ctx->nnz, MPI_INT, 0, ctx->comm);
+
+  partition_columns(ctx->col_ptr, ctx->size, ctx->ranks, PARTITION_COST,
+                    ctx->bounds);
+  for (r = 0; r < ctx->ranks; r++) {
+    ctx->displs[r] = ctx->col_ptr[ctx->bounds[r]];
+    ctx->counts[r] = ctx->col_ptr[ctx->bounds[r+1]] - ctx->displs[r];
+  }
+  if (ctx->rank != 0) {
+    ctx->values = (double*) malloc((ctx->nnz ? ctx->nnz : 1) *
+                                   sizeof(double));
+    ctx->local_inv = (double*) malloc((ctx->counts[ctx->rank] ?
+                                       ctx->counts[ctx->rank] : 1) *
+                                      sizeof(double));
+  }
+}
+
+/* Forget what the workspaces counted in the last call */
+static void reset_counts(struct workspace *ws, int num) {
+  int t;
+  for (t = 0; t < num; t++) {
+    ws[t].refined = 0;
+    ws[t].refine_steps = 0;
+    ws[t].refine_fallbacks = 0;
+    ws[t].flops = .0;
+    memset(ws[t].dim_hist, 0, sizeof(ws[t].dim_hist));
+    memset(ws[t].time_hist, 0, sizeof(ws[t].time_hist));
+  }
+}
+
+/* Compute the inverse p-th root of the matrix of dimension size in col_ptr,
+ * row_ind and values on rank 0 into values_inv on rank 0, which has room
+ * for col_ptr[size] entries. The other ranks pass NULL for all of them.
+ * Returns 0, or -1 on all ranks if the matrix is empty. */
+int submatrix_solve(struct submatrix_context *ctx, MKL_INT size,
+                    MKL_INT *col_ptr, MKL_INT *row_ind, double *values,
+                    double *values_inv) {
+  MKL_INT header[3], first, last;
+  int prev_threads;
+  double *vals, *out;
+
+  if (ctx->rank == 0) {
+    header[0] = size;
+    header[1] = size > 0 ? col_ptr[size] : 0;
+    header[2] = ctx->col_ptr && size == ctx->size &&
+                header[1] == ctx->nnz &&
+                memcmp(col_ptr, ctx->col_ptr,
+                       (size + 1) * sizeof(MKL_INT)) == 0 &&
+                memcmp(row_ind, ctx->row_ind,
+                       header[1] * sizeof(MKL_INT)) == 0;
+  }
+  MPI_Bcast(header, 3, MPI_INT, 0, ctx->comm);
+  if (header[0] <= 0) {
+    return -1;
+  }
+  if (!header[2]) {
+    ctx->size = header[0];
+    ctx->nnz = header[1];
+    update_pattern(ctx, size, col_ptr, row_ind);
+  }
+  vals = ctx->rank == 0 ? values : ctx->values;
+  MPI_Bcast(vals, ctx->nnz, MPI_DOUBLE, 0, ctx->comm);
+
+  if (!ctx->ws || ctx->threads != omp_get_max_threads()) {
+    if (ctx->ws) {
+      free_workspaces(ctx->ws, ctx->threads);
+    }
+    ctx->threads = omp_get_max_threads();
+    ctx->ws = create_workspaces(ctx->threads, 0, &ctx->opts);
+  }
+  reset_counts(ctx->ws, ctx->threads);
+
+  // One thread in MKL per submatrix, see solve_columns for the large ones
+  first = ctx->bounds[ctx->rank];
+  last = ctx->bounds[ctx->rank + 1];
+  out = ctx->rank == 0 ? &(values_inv[ctx->displs[0]]) : ctx->local_inv;
+  memset(&ctx->stats, 0, sizeof(ctx->stats));
+  prev_threads = mkl_set_num_threads_local(1);
+  solve_columns(vals, ctx->row_ind, ctx->col_ptr, out, first, last,
+                &ctx->opts, ctx->ws, &ctx->stats);
+  mkl_set_num_threads_local(prev_threads);
+  collect_workspaces(ctx->ws, ctx->threads, &ctx->stats);
+
+  MPI_Gatherv(ctx->rank == 0 ? MPI_IN_PLACE : ctx->local_inv,
+              ctx->counts[ctx->rank], MPI_DOUBLE, values_inv, ctx->counts,
+              ctx->displs, MPI_DOUBLE, 0, ctx->comm);
+  return 0;
+}
+
+/* What this rank did in the last call */
+void submatrix_stats(struct submatrix_context *ctx,
+                     struct solve_stats *stats) {
+  *stats = ctx->stats;
+}
+
+void submatrix_finalize(struct submatrix_context *ctx) {
+  if (ctx->ws) {
+    free_workspaces(ctx->ws, ctx->threads);
+  }
+  free(ctx->local_inv);
+  free(ctx->values);
+  free(ctx->row_ind);
+  free(ctx->col_ptr);
+  free(ctx->displs);
+  free(ctx->counts);
+  free(ctx->bounds);
+  MPI_Comm_free(&ctx->comm);
+  free(ctx);
+}
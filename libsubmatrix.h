@@ -0,0 +1,48 @@
+#ifndef LIBSUBMATRIX_H
+#define LIBSUBMATRIX_H
+
+#include <mkl.h>
+#include <mpi.h>
+#include "solve.h"
+#include "submatrix.h"
+
+/* The submatrix method as a library, for codes that compute inverse p-th
+ * roots of many matrices with the same pattern, one after the other:
+ *
+ *   struct solver_options opts;
+ *   submatrix_default_options(&opts);
+ *   ctx = submatrix_init(comm, &opts);
+ *   for (each matrix) {
+ *     submatrix_solve(ctx, size, col_ptr, row_ind, values, values_inv);
+ *   }
+ *   submatrix_finalize(ctx);
+ *
+ * All calls are collective over comm. The matrix is given in CSC on rank 0
+ * of comm, which also gets the result, in the pattern of the matrix. The
+ * other ranks pass NULL. All ranks solve a share of the columns.
+ *
+ * The context keeps what does not change between calls: a copy of comm,
+ * the workspaces of the threads, and the pattern and its partition on all
+ * ranks. As long as the pattern stays the same, a call only broadcasts the
+ * values and gathers the results. Link with libsubmatrix.a and MKL, with
+ * OpenMP enabled. */
+struct submatrix_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void submatrix_default_options(struct solver_options *opts);
+struct submatrix_context *submatrix_init(MPI_Comm comm,
+                                         struct solver_options *opts);
+int submatrix_solve(struct submatrix_context *ctx, MKL_INT size,
+                    MKL_INT *col_ptr, MKL_INT *row_ind, double *values,
+                    double *values_inv);
+void submatrix_stats(struct submatrix_context *ctx, struct solve_stats *stats);
+void submatrix_finalize(struct submatrix_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
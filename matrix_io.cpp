@@ -22,54 +22,828 @@
  * SOFTWARE.
  */
 
+#include <charconv>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
+#include <mkl.h>
+#include <omp.h>
+#include <stdint.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "matrix_io.h"
 
+/* A text file mapped into memory, split into one chunk of whole lines per
+ * thread. Every line that is not blank is a row of the matrix. */
+struct text_file {
+  const char *data;
+  size_t length;
+  int chunks;
+  size_t *start;   // chunk c is data[start[c]] to data[start[c+1]-1]
+  long *first_row; // number of the first row of each chunk
+  long rows;
+};
+
+static const char *line_end(const char *p, const char *end) {
+  const char *eol = (const char*) memchr(p, '\n', end - p);
+  return eol ? eol : end;
+}
+
+static bool is_blank(const char *p, const char *eol) {
+  for (; p < eol; p++) {
+    if (*p != ' ' && *p != '\t' && *p != '\r') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Map fn and split it at line breaks into one chunk per thread. A first pass
+ * over the chunks counts their rows, so each thread knows where its rows
+ * start before parsing. */
+static int map_text(const char *fn, struct text_file *f) {
+  struct stat st;
+  int fd, c;
+
+  memset(f, 0, sizeof(*f));
+  fd = open(fn, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "%s: Cannot open file\n", fn);
+    return -1;
+  }
+  fstat(fd, &st);
+  f->length = st.st_size;
+  if (f->length > 0) {
+    f->data = (const char*) mmap(NULL, f->length, PROT_READ, MAP_PRIVATE, fd,
+                                 0);
+    if (f->data == MAP_FAILED) {
+      fprintf(stderr, "%s: Cannot map file\n", fn);
+      close(fd);
+      return -1;
+    }
+    madvise((void*) f->data, f->length, MADV_WILLNEED);
+  }
+  close(fd);
+
+  f->chunks = omp_get_max_threads();
+  f->start = (size_t*) malloc((f->chunks + 1) * sizeof(size_t));
+  f->first_row = (long*) calloc(f->chunks + 1, sizeof(long));
+  for (c = 0; c < f->chunks; c++) {
+    f->start[c] = f->length / f->chunks * c;
+    if (c > 0 && f->start[c] > 0) {
+      // Move to the start of the next line, unless we are already there
+      const char *p = f->data + f->start[c] - 1;
+      f->start[c] = line_end(p, f->data + f->length) - f->data + 1;
+      if (f->start[c] > f->length) {
+        f->start[c] = f->length;
+      }
+      if (f->start[c] < f->start[c-1]) {
+        f->start[c] = f->start[c-1];
+      }
+    }
+  }
+  f->start[f->chunks] = f->length;
+
+  #pragma omp parallel for
+  for (c = 0; c < f->chunks; c++) {
+    const char *p = f->data + f->start[c], *end = f->data + f->start[c+1];
+    const char *eol;
+    long rows = 0;
+    for (; p < end; p = eol + 1) {
+      eol = line_end(p, end);
+      if (!is_blank(p, eol)) {
+        rows++;
+      }
+    }
+    f->first_row[c+1] = rows;
+  }
+  for (c = 0; c < f->chunks; c++) {
+    f->first_row[c+1] += f->first_row[c];
+  }
+  f->rows = f->first_row[f->chunks];
+  return 0;
+}
+
+static void unmap_text(struct text_file *f) {
+  if (f->length > 0) {
+    munmap((void*) f->data, f->length);
+  }
+  free(f->first_row);
+  free(f->start);
+}
+
+/* Parse a number at p, which ends at the next comma or line break. Numbers
+ * with up to 19 significant digits and a power of ten up to 22 are exact in
+ * double arithmetic (Clinger's fast path), that covers what MATLAB writes.
+ * Everything else, including inf and nan, goes through strtod. Returns the
+ * end of the number. */
+static const char *parse_double(const char *p, const char *end, double *val) {
+  static const double pow10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *start, *q;
+  char buf[64];
+  uint64_t mantissa = 0;
+  int digits = 0, any = 0, exp10 = 0, e = 0, neg = 0, eneg = 0;
+  size_t len;
+
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  start = p;
+  if (p < end && (*p == '-' || *p == '+')) {
+    neg = *p == '-';
+    p++;
+  }
+  for (; p < end && *p >= '0' && *p <= '9'; p++, any = 1) {
+    if (mantissa || *p != '0') {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits++;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = 1) {
+      if (mantissa || *p != '0') {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits++;
+      }
+      exp10--;
+    }
+  }
+  if (any && p < end && (*p == 'e' || *p == 'E')) {
+    q = p + 1;
+    if (q < end && (*q == '-' || *q == '+')) {
+      eneg = *q == '-';
+      q++;
+    }
+    if (q < end && *q >= '0' && *q <= '9') {
+      for (p = q; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (e < 10000) {
+          e = e * 10 + (*p - '0');
+        }
+      }
+      exp10 += eneg ? -e : e;
+    }
+  }
+
+  if (any && (p == end || *p == ',' || *p == '\n' || *p == '\r' ||
+              *p == ' ' || *p == '\t')) {
+    if (mantissa == 0) {
+      *val = neg ? -0. : 0.;
+      return p;
+    }
+    if (digits <= 19 && mantissa <= (1ULL << 53) &&
+        exp10 >= -22 && exp10 <= 22) {
+      *val = exp10 < 0 ? (double) mantissa / pow10[-exp10] :
+                         (double) mantissa * pow10[exp10];
+      *val = neg ? -*val : *val;
+      return p;
+    }
+  }
+
+  // The slow path needs a terminated copy, the mapping has no terminator
+  for (p = start; p < end && *p != ',' && *p != '\n'; p++);
+  len = p - start < (long) sizeof(buf) - 1 ? p - start : sizeof(buf) - 1;
+  memcpy(buf, start, len);
+  buf[len] = '\0';
+  *val = strtod(buf, NULL);
+  return p;
+}
+
+/* Parse the rows of chunk c and hand every nonzero to add(row, col, value).
+ * Returns the number of entries beyond column size-1. */
+template <typename Add> static long parse_chunk(struct text_file *f, int c,
+  long size, Add add) {
+
+  const char *p = f->data + f->start[c], *end = f->data + f->start[c+1];
+  const char *eol;
+  long i = f->first_row[c], j, overflow = 0;
+  double val;
+
+  for (; p < end; p = eol + 1) {
+    eol = line_end(p, end);
+    if (is_blank(p, eol)) {
+      continue;
+    }
+    for (j = 0; p < eol; j++) {
+      p = parse_double(p, eol, &val);
+      if (val != 0.) {
+        if (j < size) {
+          add(i, j, val);
+        } else {
+          overflow++;
+        }
+      }
+      while (p < eol && *p != ',') {
+        p++;
+      }
+      if (p < eol) {
+        p++;
+      }
+    }
+    i++;
+  }
+  return overflow;
+}
+
+static int check_shape(const char *fn, struct text_file *f, long size,
+  long overflow) {
+
+  if (f->rows != size || overflow) {
+    fprintf(stderr, "%s: Expected a %ld x %ld matrix, found %ld rows%s\n", fn,
+            size, size, f->rows, overflow ? " and longer ones" : "");
+    return -1;
+  }
+  return 0;
+}
+
 template <typename T> void read_input_matrix_templ(T *matrix_in, long *nnz,
   long size, char *fn_in) {
 
-  long i, j;
-  char buf[BUF_SIZE];
-  char *bufp, *token;
-  FILE *stream_in;
-  T val;
+  struct text_file f;
+  long overflow = 0;
+  int c;
+
+  if (map_text(fn_in, &f) != 0) {
+    return;
+  }
+  if (f.rows > size) {
+    check_shape(fn_in, &f, size, 0);
+    unmap_text(&f);
+    return;
+  }
+  #pragma omp parallel for reduction(+:overflow)
+  for (c = 0; c < f.chunks; c++) {
+    overflow += parse_chunk(&f, c, size, [&](long i, long j, double val) {
+      matrix_in[i * size + j] = (T) val;
+      #pragma omp atomic
+      nnz[j]++;
+    });
+  }
+  check_shape(fn_in, &f, size, overflow);
+  unmap_text(&f);
+}
+
+struct entry {
+  MKL_INT row;
+  double val;
+};
+
+static int compare_entry(const void *a, const void *b) {
+  MKL_INT x = ((const struct entry*) a)->row, y = ((const struct entry*) b)->row;
+  return (x > y) - (x < y);
+}
+
+/* Sort the triplets found by the threads into CSC with a counting sort on
+ * the column. With mirror != 0 every entry off the diagonal also stands for
+ * its transpose, multiplied by mirror. The triplets are freed, the arrays
+ * malloc'ed for the caller. Returns the number of duplicate entries, which
+ * are left in place. */
+long triplets_to_csc(struct triplet **found, long *count, int chunks,
+  long size, int mirror, MKL_INT **col_ptr, MKL_INT **row_ind,
+  double **values) {
+
+  struct entry *entries;
+  MKL_INT *next, *cp, nnz;
+  long duplicates = 0, i;
+  int c;
+
+  cp = (MKL_INT*) calloc(size + 1, sizeof(MKL_INT));
+  #pragma omp parallel for
+  for (c = 0; c < chunks; c++) {
+    long k;
+    for (k = 0; k < count[c]; k++) {
+      #pragma omp atomic
+      cp[found[c][k].col + 1]++;
+      if (mirror && found[c][k].row != found[c][k].col) {
+        #pragma omp atomic
+        cp[found[c][k].row + 1]++;
+      }
+    }
+  }
+  for (i = 0; i < size; i++) {
+    cp[i+1] += cp[i];
+  }
+  nnz = cp[size];
+  next = (MKL_INT*) malloc((size ? size : 1) * sizeof(MKL_INT));
+  memcpy(next, cp, size * sizeof(MKL_INT));
+  entries = (struct entry*) malloc((nnz ? nnz : 1) * sizeof(struct entry));
+
+  #pragma omp parallel for
+  for (c = 0; c < chunks; c++) {
+    struct triplet *t;
+    MKL_INT pos;
+    long k;
+    for (k = 0; k < count[c]; k++) {
+      t = &(found[c][k]);
+      #pragma omp atomic capture
+      pos = next[t->col]++;
+      entries[pos].row = t->row;
+      entries[pos].val = t->val;
+      if (mirror && t->row != t->col) {
+        #pragma omp atomic capture
+        pos = next[t->row]++;
+        entries[pos].row = t->col;
+        entries[pos].val = mirror * t->val;
+      }
+    }
+    free(found[c]);
+  }
+  free(next);
+
+  // Threads filled the columns in any order, so sort each column by row
+  *row_ind = (MKL_INT*) malloc((nnz ? nnz : 1) * sizeof(MKL_INT));
+  *values = (double*) malloc((nnz ? nnz : 1) * sizeof(double));
+  #pragma omp parallel for schedule(dynamic, 256) reduction(+:duplicates)
+  for (i = 0; i < size; i++) {
+    MKL_INT k;
+    qsort(&(entries[cp[i]]), cp[i+1] - cp[i], sizeof(struct entry),
+          compare_entry);
+    for (k = cp[i]; k < cp[i+1]; k++) {
+      (*row_ind)[k] = entries[k].row;
+      (*values)[k] = entries[k].val;
+      if (k > cp[i] && entries[k].row == entries[k-1].row) {
+        duplicates++;
+      }
+    }
+  }
+  free(entries);
+  *col_ptr = cp;
+  return duplicates;
+}
+
+/* Append a triplet to the growing array of a thread */
+void add_triplet(struct triplet **found, long *count, long *capacity,
+  long i, long j, double val) {
+
+  if (*count == *capacity) {
+    *capacity = *capacity ? 2 * *capacity : 4096;
+    *found = (struct triplet*) realloc(*found,
+                                       *capacity * sizeof(struct triplet));
+  }
+  (*found)[*count].row = i;
+  (*found)[*count].col = j;
+  (*found)[*count].val = val;
+  (*count)++;
+}
+
+/* Read the dense text matrix fn_in of dimension size straight into CSC
+ * without a dense copy: every thread collects the nonzeros of its rows,
+ * a counting sort on the column puts them in place. Memory stays O(nnz)
+ * and lines can have any length. The arrays are malloc'ed for the caller.
+ * Returns 0 on success. */
+int read_input_csc_d(char *fn_in, long size, MKL_INT **col_ptr,
+  MKL_INT **row_ind, double **values) {
+
+  struct text_file f;
+  struct triplet **found;
+  long *count, overflow = 0;
+  int c;
 
-  stream_in = fopen(fn_in, "r");
-  i = 0;
-  while (fgets(buf, BUF_SIZE, stream_in)) {
-    if (strlen(buf) == 0)
+  if (map_text(fn_in, &f) != 0) {
+    return -1;
+  }
+  found = (struct triplet**) calloc(f.chunks, sizeof(struct triplet*));
+  count = (long*) calloc(f.chunks, sizeof(long));
+
+  #pragma omp parallel for reduction(+:overflow)
+  for (c = 0; c < f.chunks; c++) {
+    long capacity = 0;
+    overflow += parse_chunk(&f, c, size, [&](long i, long j, double val) {
+      add_triplet(&(found[c]), &(count[c]), &capacity, i, j, val);
+    });
+  }
+  if (check_shape(fn_in, &f, size, overflow) != 0) {
+    for (c = 0; c < f.chunks; c++) {
+      free(found[c]);
+    }
+    free(found);
+    free(count);
+    unmap_text(&f);
+    return -1;
+  }
+  unmap_text(&f);
+
+  triplets_to_csc(found, count, f.chunks, size, 0, col_ptr, row_ind,
+                  values);
+  free(found);
+  free(count);
+  return 0;
+}
+
+/* Parse a 1-based index at p into *idx. Returns the end of it, or NULL if
+ * there is none. */
+static const char *parse_index(const char *p, const char *end, long *idx) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  if (p == end || *p < '0' || *p > '9') {
+    return NULL;
+  }
+  for (*idx = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+    *idx = *idx * 10 + (*p - '0');
+  }
+  return p;
+}
+
+static bool starts_with(const char *p, const char *end, const char *word) {
+  size_t len = strlen(word);
+  return (size_t)(end - p) >= len && strncasecmp(p, word, len) == 0;
+}
+
+/* Read the Matrix Market banner and size line at the start of f, if there
+ * is one. Returns the offset of the first entry, or -1 for headers we
+ * cannot handle. */
+static long parse_banner(const char *fn, struct text_file *f,
+  struct coordinate_info *info) {
+
+  const char *p = f->data, *end = f->data + f->length, *eol, *q;
+  long rows, cols, entries;
+
+  if (!starts_with(p, end, "%%MatrixMarket")) {
+    return 0;
+  }
+  eol = line_end(p, end);
+  info->matrix_market = 1;
+  info->mirror = 0;
+  for (q = p; q < eol; q++) {
+    if (starts_with(q, eol, " array")) {
+      fprintf(stderr, "%s: Only coordinate Matrix Market files are "
+              "supported\n", fn);
+      return -1;
+    }
+    if (starts_with(q, eol, " complex") || starts_with(q, eol, " hermitian")) {
+      fprintf(stderr, "%s: Complex matrices are not supported\n", fn);
+      return -1;
+    }
+    if (starts_with(q, eol, " pattern")) {
+      info->pattern = 1;
+    }
+    if (starts_with(q, eol, " symmetric")) {
+      info->mirror = 1;
+    }
+    if (starts_with(q, eol, " skew-symmetric")) {
+      info->mirror = -1;
+    }
+  }
+
+  // Comments until the size line, "rows columns entries"
+  for (p = eol + 1; p < end; p = eol + 1) {
+    eol = line_end(p, end);
+    if (*p != '%' && !is_blank(p, eol)) {
+      break;
+    }
+  }
+  if (p >= end || !(q = parse_index(p, eol, &rows)) ||
+      !(q = parse_index(q, eol, &cols)) ||
+      !(q = parse_index(q, eol, &entries))) {
+    fprintf(stderr, "%s: Missing the size line\n", fn);
+    return -1;
+  }
+  if (rows != cols) {
+    fprintf(stderr, "%s: Matrix is %ld x %ld, not square\n", fn, rows, cols);
+    return -1;
+  }
+  info->size = rows;
+  info->entries = entries;
+  return eol + 1 - f->data;
+}
+
+/* Parse the entries "row column value" in chunk c and hand each to
+ * add(row, col, value) with 0-based indices. Lines starting with % or #
+ * are comments. Returns the number of lines that are not entries. */
+template <typename Add> static long parse_entries(struct text_file *f, int c,
+  int pattern, Add add) {
+
+  const char *p = f->data + f->start[c], *end = f->data + f->start[c+1];
+  const char *eol, *q;
+  long i, j, bad = 0;
+  double val = 1.;
+
+  for (; p < end; p = eol + 1) {
+    eol = line_end(p, end);
+    for (q = p; q < eol && (*q == ' ' || *q == '\t'); q++);
+    if (q == eol || *q == '%' || *q == '#' || is_blank(q, eol)) {
       continue;
-    bufp = &(buf[0]);
-    j = 0;
-    while ((token = strsep(&bufp, ","))) {
-      val = strtod(token, NULL);
-      if (val) {
-        matrix_in[i * size + j] = val;
-        nnz[j]++;
+    }
+    if (!(q = parse_index(q, eol, &i)) || !(q = parse_index(q, eol, &j)) ||
+        i == 0 || j == 0) {
+      bad++;
+      continue;
+    }
+    if (!pattern) {
+      while (q < eol && (*q == ' ' || *q == '\t')) {
+        q++;
       }
-      j++;
+      if (q == eol || *q == '\r') {
+        bad++;
+        continue;
+      }
+      parse_double(q, eol, &val);
     }
-    i++;
+    add(i - 1, j - 1, val);
   }
-  fclose(stream_in);
+  return bad;
+}
+
+/* Read a coordinate file, lines of "row column value" with 1-based indices
+ * as our electronic structure codes write them, or a coordinate Matrix
+ * Market file, into CSC. Every thread parses a chunk of the lines, a
+ * counting sort on the column builds CSC. info->size gives the dimension of
+ * plain coordinate files, 0 takes the largest index. Symmetric Matrix
+ * Market files and, with info->mirror set by the caller, plain ones store
+ * one triangle which is mirrored to the full matrix. The arrays are
+ * malloc'ed for the caller, info describes what was read. Returns 0 on
+ * success. */
+int read_coordinate_csc_d(char *fn_in, struct coordinate_info *info,
+  MKL_INT **col_ptr, MKL_INT **row_ind, double **values) {
+
+  struct text_file f;
+  struct triplet **found;
+  long *count, *max_idx, header, bad = 0, entries = 0, size = 0, duplicates;
+  long lower = 0, upper = 0;
+  int c, ret = 0;
+
+  if (map_text(fn_in, &f) != 0) {
+    return -1;
+  }
+  info->matrix_market = 0;
+  info->pattern = 0;
+  info->entries = 0;
+  header = parse_banner(fn_in, &f, info);
+  if (header < 0) {
+    unmap_text(&f);
+    return -1;
+  }
+  // The chunks split the whole file, move them past the header
+  for (c = 0; c <= f.chunks; c++) {
+    if (f.start[c] < (size_t) header) {
+      f.start[c] = header < (long) f.length ? header : f.length;
+    }
+  }
+
+  found = (struct triplet**) calloc(f.chunks, sizeof(struct triplet*));
+  count = (long*) calloc(f.chunks, sizeof(long));
+  max_idx = (long*) calloc(f.chunks, sizeof(long));
+  #pragma omp parallel for reduction(+:bad,lower,upper)
+  for (c = 0; c < f.chunks; c++) {
+    long capacity = 0;
+    bad += parse_entries(&f, c, info->pattern, [&](long i, long j,
+                                                   double val) {
+      add_triplet(&(found[c]), &(count[c]), &capacity, i, j, val);
+      max_idx[c] = i > max_idx[c] ? i : max_idx[c];
+      max_idx[c] = j > max_idx[c] ? j : max_idx[c];
+      lower += i > j;
+      upper += i < j;
+    });
+  }
+  unmap_text(&f);
+
+  for (c = 0; c < f.chunks; c++) {
+    entries += count[c];
+    size = count[c] && max_idx[c] + 1 > size ? max_idx[c] + 1 : size;
+  }
+  if (bad) {
+    fprintf(stderr, "%s: %ld lines are not entries \"row column%s\"\n", fn_in,
+            bad, info->pattern ? "" : " value");
+    ret = -1;
+  } else if (info->matrix_market && entries != info->entries) {
+    fprintf(stderr, "%s: Expected %ld entries, found %ld\n", fn_in,
+            info->entries, entries);
+    ret = -1;
+  } else if (info->size > 0 && size > info->size) {
+    fprintf(stderr, "%s: Index %ld is beyond the size %ld\n", fn_in, size,
+            info->size);
+    ret = -1;
+  } else if (info->mirror && lower && upper) {
+    fprintf(stderr, "%s: Entries on both sides of the diagonal, but only one "
+            "triangle is expected\n", fn_in);
+    ret = -1;
+  }
+  if (ret != 0) {
+    for (c = 0; c < f.chunks; c++) {
+      free(found[c]);
+    }
+    free(found);
+    free(count);
+    free(max_idx);
+    return -1;
+  }
+
+  if (info->size == 0) {
+    info->size = size;
+  }
+  info->entries = entries;
+  info->triangle = lower && !upper ? 'L' : upper && !lower ? 'U' : 0;
+  duplicates = triplets_to_csc(found, count, f.chunks, info->size,
+                               info->mirror, col_ptr, row_ind, values);
+  free(found);
+  free(count);
+  free(max_idx);
+  if (duplicates) {
+    fprintf(stderr, "%s: %ld entries appear more than once\n", fn_in,
+            duplicates);
+    free(*col_ptr);
+    free(*row_ind);
+    free(*values);
+    return -1;
+  }
+  return 0;
+}
+/* Longest text of a single number, "-2.2250738585072014e-308" */
+#define MAX_NUMBER_LEN 32
+/* Bytes each thread formats before they are written */
+#define WRITE_BLOCK (8 << 20)
+/* Zeros in the template copied for runs of zeros */
+#define ZERO_RUN 1024
+
+/* Write a number in the given format. TEXT_EXP is what printf's %e gives,
+ * TEXT_SHORTEST the shortest text that reads back as the same value. */
+template <typename T> static char *format_number(char *p, T val, int format) {
+  std::to_chars_result r;
+  if (format == TEXT_SHORTEST) {
+    r = std::to_chars(p, p + MAX_NUMBER_LEN, val);
+  } else {
+    r = std::to_chars(p, p + MAX_NUMBER_LEN, (double) val,
+                      std::chars_format::scientific, 6);
+  }
+  return r.ptr;
+}
+
+/* ZERO_RUN zeros with a comma after each, and the length of one of them */
+static char *make_zeros(int format, size_t *token) {
+  char one[MAX_NUMBER_LEN], *zeros, *p;
+  long k;
+
+  *token = format_number(one, 0., format) - one + 1;
+  zeros = (char*) malloc(ZERO_RUN * *token);
+  for (k = 0, p = zeros; k < ZERO_RUN; k++) {
+    p = format_number(p, 0., format);
+    *p++ = ',';
+  }
+  return zeros;
+}
+
+static char *emit_zeros(char *p, long count, const char *zeros, size_t token) {
+  long n;
+  for (; count > 0; count -= n) {
+    n = count < ZERO_RUN ? count : ZERO_RUN;
+    memcpy(p, zeros, n * token);
+    p += n * token;
+  }
+  return p;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+  ssize_t n;
+  for (; len > 0; buf += n, len -= n) {
+    n = write(fd, buf, len);
+    if (n < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Write size rows of text to fn_out, format_row(i, p) puts row i at p and
+ * returns its end. Every thread formats a block of rows into its own buffer,
+ * then the blocks go out in order with one write each. */
+template <typename Format> static int write_rows(const char *fn_out,
+  long size, Format format_row) {
+
+  size_t max_row = size * MAX_NUMBER_LEN + 1, *len;
+  long rows, base;
+  char **buf;
+  int fd, t, threads, ret = 0;
+
+  fd = open(fn_out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "%s: Cannot open file for writing\n", fn_out);
+    return -1;
+  }
+  threads = omp_get_max_threads();
+  rows = WRITE_BLOCK / max_row > 0 ? WRITE_BLOCK / max_row : 1;
+  buf = (char**) malloc(threads * sizeof(char*));
+  len = (size_t*) calloc(threads, sizeof(size_t));
+  for (t = 0; t < threads; t++) {
+    buf[t] = (char*) malloc(rows * max_row);
+  }
+
+  for (base = 0; base < size && ret == 0; base += threads * rows) {
+    #pragma omp parallel num_threads(threads)
+    {
+      int me = omp_get_thread_num();
+      long i, first = base + me * rows, last = first + rows;
+      char *p = buf[me];
+      for (i = first; i < last && i < size; i++) {
+        p = format_row(i, p);
+      }
+      len[me] = p - buf[me];
+    }
+    for (t = 0; t < threads && ret == 0; t++) {
+      ret = write_all(fd, buf[t], len[t]);
+    }
+  }
+  if (ret != 0) {
+    fprintf(stderr, "%s: Write failed\n", fn_out);
+  }
+
+  for (t = 0; t < threads; t++) {
+    free(buf[t]);
+  }
+  free(len);
+  free(buf);
+  close(fd);
+  return ret;
 }
 
 template <typename T> void write_output_matrix_templ(T *matrix_out, long size,
-  char *fn_out) {
+  char *fn_out, int format) {
 
-  long i, j;
-  FILE *stream_out;
+  size_t token;
+  char *zeros = make_zeros(format, &token);
 
-  stream_out = fopen(fn_out, "w");
-  for (i = 0; i < size; i++) {
-    for (j = 0; j < size-1; j++) {
-      fprintf(stream_out, "%e,", matrix_out[i * size + j]);
+  write_rows(fn_out, size, [&](long i, char *p) {
+    long j;
+    T val;
+    for (j = 0; j < size; j++) {
+      val = matrix_out[i * size + j];
+      if (val == 0 && !std::signbit(val)) {
+        p = emit_zeros(p, 1, zeros, token);
+      } else {
+        p = format_number(p, val, format);
+        *p++ = ',';
+      }
     }
-    fprintf(stream_out, "%e\n", matrix_out[(i+1) * size - 1]);
+    p[-1] = '\n';
+    return p;
+  });
+  free(zeros);
+}
+
+/* Write the CSC matrix as dense text like write_output_matrix_d, without
+ * expanding it. Rows are streamed from CSR, which for a symmetric matrix is
+ * the CSC arrays themselves. Otherwise they are transposed first, in O(nnz)
+ * memory. Returns 0 on success. */
+int write_output_csc_d(char *fn_out, long size, MKL_INT *col_ptr,
+  MKL_INT *row_ind, double *values, int symmetric, int format) {
+
+  MKL_INT *row_ptr = col_ptr, *col_ind = row_ind, *next, k;
+  double *csr_values = values;
+  size_t token;
+  char *zeros;
+  long i;
+  int ret;
+
+  if (!symmetric) {
+    row_ptr = (MKL_INT*) calloc(size + 1, sizeof(MKL_INT));
+    col_ind = (MKL_INT*) malloc((col_ptr[size] ? col_ptr[size] : 1) *
+                                sizeof(MKL_INT));
+    csr_values = (double*) malloc((col_ptr[size] ? col_ptr[size] : 1) *
+                                  sizeof(double));
+    for (k = 0; k < col_ptr[size]; k++) {
+      row_ptr[row_ind[k] + 1]++;
+    }
+    for (i = 0; i < size; i++) {
+      row_ptr[i+1] += row_ptr[i];
+    }
+    next = (MKL_INT*) malloc((size ? size : 1) * sizeof(MKL_INT));
+    memcpy(next, row_ptr, size * sizeof(MKL_INT));
+    // Going through the columns in order keeps every row sorted
+    for (i = 0; i < size; i++) {
+      for (k = col_ptr[i]; k < col_ptr[i+1]; k++) {
+        col_ind[next[row_ind[k]]] = i;
+        csr_values[next[row_ind[k]]++] = values[k];
+      }
+    }
+    free(next);
+  }
+
+  zeros = make_zeros(format, &token);
+  ret = write_rows(fn_out, size, [&](long i, char *p) {
+    MKL_INT k, j = 0;
+    for (k = row_ptr[i]; k < row_ptr[i+1]; k++) {
+      p = emit_zeros(p, col_ind[k] - j, zeros, token);
+      p = format_number(p, csr_values[k], format);
+      *p++ = ',';
+      j = col_ind[k] + 1;
+    }
+    p = emit_zeros(p, size - j, zeros, token);
+    p[-1] = '\n';
+    return p;
+  });
+  free(zeros);
+
+  if (!symmetric) {
+    free(csr_values);
+    free(col_ind);
+    free(row_ptr);
   }
-  fclose(stream_out);
+  return ret;
 }
 
 extern "C" {
@@ -83,10 +857,10 @@ extern "C" {
   }
   void write_output_matrix_f(float *matrix_out, long size,
     char *fn_out) {
-    write_output_matrix_templ<float>(matrix_out, size, fn_out);
+    write_output_matrix_templ<float>(matrix_out, size, fn_out, TEXT_EXP);
   }
   void write_output_matrix_d(double *matrix_out, long size,
     char *fn_out) {
-    write_output_matrix_templ<double>(matrix_out, size, fn_out);
+    write_output_matrix_templ<double>(matrix_out, size, fn_out, TEXT_EXP);
   }
 }
@@ -1,4 +1,28 @@
-#define BUF_SIZE 131072
+#include <mkl.h>
+
+/* How numbers are written as text */
+enum text_format {
+  TEXT_EXP      = 0, // like printf's %e, as we always did
+  TEXT_SHORTEST = 1  // the shortest text that reads back as the same value
+};
+
+/* A nonzero on its way into CSC, see triplets_to_csc */
+struct triplet {
+  MKL_INT row;
+  MKL_INT col;
+  double val;
+};
+
+/* What read_coordinate_csc_d found in a coordinate file. size and mirror
+ * are also inputs for plain coordinate files, which have no header. */
+struct coordinate_info {
+  long size;         // dimension, 0 to take the largest index
+  long entries;      // entries in the file, not counting mirrored ones
+  int mirror;        // 1 symmetric, -1 skew-symmetric, one triangle stored
+  int matrix_market; // the file has a Matrix Market header
+  int pattern;       // entries have no values, they are all 1
+  int triangle;      // 'L' or 'U' if all entries off the diagonal are there
+};
 
 #ifdef __cplusplus
 extern "C" {
@@ -6,8 +30,21 @@ extern "C" {
 
 void read_input_matrix_f(float *matrix_in, long *nnz, long size, char *fn_in);
 void read_input_matrix_d(double *matrix_in, long *nnz, long size, char *fn_in);
+int read_input_csc_d(char *fn_in, long size, MKL_INT **col_ptr,
+                     MKL_INT **row_ind, double **values);
+int read_coordinate_csc_d(char *fn_in, struct coordinate_info *info,
+                          MKL_INT **col_ptr, MKL_INT **row_ind,
+                          double **values);
+void add_triplet(struct triplet **found, long *count, long *capacity, long i,
+                 long j, double val);
+long triplets_to_csc(struct triplet **found, long *count, int chunks,
+                     long size, int mirror, MKL_INT **col_ptr,
+                     MKL_INT **row_ind, double **values);
 void write_output_matrix_f(float *matrix_out, long size, char *fn_out);
 void write_output_matrix_d(double *matrix_out, long size, char *fn_out);
+int write_output_csc_d(char *fn_out, long size, MKL_INT *col_ptr,
+                       MKL_INT *row_ind, double *values, int symmetric,
+                       int format);
 
 #ifdef __cplusplus
 }
@@ -31,105 +31,325 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include "bench.h"
+#include "csc_io.h"
+#include "filter.h"
+#include "halo.h"
+#include "incremental.h"
+#include "libsubmatrix.h"
+#include "mpi_input.h"
+#include "mpi_output.h"
+#include "partition.h"
+#include "reorder.h"
+#include "residual.h"
+#include "solve.h"
+#include "submatrix.h"
+#include "trace.h"
+#include "workspace.h"
 
 #define PATHLEN 255
 
+/* How the workers get the matrix with the static partition. */
+enum distribution {
+  DIST_BCAST = 0, // rank 0 broadcasts all of it
+  DIST_HALO  = 1, // rank 0 sends each worker only its halo
+  DIST_MPIIO = 2  // each worker reads its halo itself with MPI-IO
+};
+
+/* Where the results go. */
+enum output {
+  OUTPUT_GATHER = 0, // to rank 0, which writes them with -W
+  OUTPUT_MPIIO  = 1  // each rank writes its own to <name>.inv.val
+};
+
 struct properties {
   int size;
   int density;
   int condition;
+  int input; // n of the input file sprandsym-s<size>-d<density>-c<cond>-n<n>
+  int min_chunk; // 0: static partition, otherwise dynamic with this chunk size
+  double tolerance; // >= 0: incremental updates, see find_dirty_columns
+  int distribution;
+  char io_hints[HINTS_LEN]; // for MPI_File_open, see mpi_input_open
+  int output;
+  char out_hints[HINTS_LEN]; // the same for the output, see write_values
+  int float_values; // values are broadcast as float, see bcast_values
+  int records; // every rank sends rank 0 a bench_record after each job
+  int trace; // record a trace, written by trace_write at the end
+  int residual; // how to estimate X^p A - I after each job, see -V
+  int residual_samples;
+  double filter; // drop smaller entries from the patterns, see filter_matrix
+  int filter_keep; // but keep their values in the submatrices
+  struct solver_options solver;
 };
 
-MKL_INT find_elem(MKL_INT needle, MKL_INT *haystack, MKL_INT size) {
-  MKL_INT l, r, c;
-  l = 0;
-  r = size;
-  do {
-    c = (l+r)/2;
-    if (haystack[c] == needle) {
-      return c;
-    }
-    if (haystack[c] < needle) {
-      l = c+1;
-    } else {
-      r = c;
-    }
-  } while (l != r);
-  return -1;
+/* Put this rank's share of a job into rec, whose times are already set */
+void fill_record(struct bench_record *rec, int rank,
+                 struct solve_stats *stats) {
+  rec->rank = rank;
+  rec->threads = omp_get_max_threads();
+  rec->build = stats->build;
+  rec->calc = stats->calc;
+  rec->columns = stats->columns;
+  rec->submatrices = stats->submatrices;
+  rec->flops = stats->flops;
+  memcpy(rec->dim_hist, stats->dim_hist, sizeof(rec->dim_hist));
+  memcpy(rec->time_hist, stats->time_hist, sizeof(rec->time_hist));
 }
 
-lapack_int invert_matrix(double *matrix, lapack_int size) {
-  // First we need to compute the LU factorization using ?getrf
-  lapack_int *ipiv, ret;
-  ipiv = (lapack_int*) mkl_calloc(size, sizeof(lapack_int), 64);
+/* Estimate the residual of the result with all ranks, see
+ * estimate_residual. Rank 0 has the input and the result in the original
+ * order and sends both, the workers pass NULL. */
+void check_residual(struct properties *prop, MKL_INT *col_ptr,
+                    MKL_INT *row_ind, double *values, double *values_inv,
+                    struct residual *res) {
+  MKL_INT nnz;
+  int rank;
 
-  ret = LAPACKE_dgetrf(LAPACK_COL_MAJOR, size, size, matrix, size, ipiv);
-  if (ret) {
-    mkl_free(ipiv);
-    return ret;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  if (rank != 0) {
+    col_ptr = (MKL_INT*) calloc(prop->size+1, sizeof(MKL_INT));
   }
+  MPI_Bcast(col_ptr, prop->size+1, MPI_INT, 0, MPI_COMM_WORLD);
+  nnz = col_ptr[prop->size];
+  if (rank != 0) {
+    row_ind = (MKL_INT*) calloc(nnz, sizeof(MKL_INT));
+    values = (double*) calloc(nnz, sizeof(double));
+    values_inv = (double*) calloc(nnz, sizeof(double));
+  }
+  MPI_Bcast(row_ind, nnz, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(values, nnz, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(values_inv, nnz, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
-  // And now we calculate the inverse using the LU factorization
-  ret = LAPACKE_dgetri(LAPACK_COL_MAJOR, size, matrix, size, ipiv);
-  mkl_free(ipiv);
-  return ret;
+  estimate_residual(prop->size, col_ptr, row_ind, values, values_inv,
+                    prop->solver.p, prop->residual, prop->residual_samples,
+                    MPI_COMM_WORLD, res);
+  if (rank != 0) {
+    free(values_inv);
+    free(values);
+    free(row_ind);
+    free(col_ptr);
+  }
 }
 
-void print_matrix(double *matrix, MKL_INT size) {
-  MKL_INT i, j;
-  for (i = 0; i < size; i++) {
-    for (j = 0; j < size; j++) {
-      printf("%.2f\t", matrix[i * size + j]);
+/* Broadcast values from rank 0. As float, if as_float is set, which halves
+ * the volume. Rank 0 rounds its own copy the same way, so all ranks solve
+ * the same matrix. */
+void bcast_values(double *values, MKL_INT count, int as_float) {
+  float *rounded;
+  MKL_INT i;
+  int rank;
+
+  if (!as_float) {
+    MPI_Bcast(values, count, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    return;
+  }
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  rounded = (float*) malloc((count ? count : 1) * sizeof(float));
+  if (rank == 0) {
+    for (i = 0; i < count; i++) {
+      rounded[i] = (float) values[i];
     }
-    printf("\n");
   }
-  printf("\n");
+  MPI_Bcast(rounded, count, MPI_FLOAT, 0, MPI_COMM_WORLD);
+  for (i = 0; i < count; i++) {
+    values[i] = rounded[i];
+  }
+  free(rounded);
 }
 
-void invert_submatrix(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
-                      double *values_inv, int i, double *locDurBuild, double *locDurCalc) {
-
-  MKL_INT nnz, k, l, kcal, lcal, idx;
-  lapack_int ret;
-  double *submatrix;
-  double tStart, tEnd;
-
-  nnz = col_ptr[i+1] - col_ptr[i];
-  submatrix = (double*) mkl_calloc(nnz*nnz, sizeof(double), 64);
-
-  tStart = omp_get_wtime();
-  for (k = 0; k < nnz; k++) {
-    for (l = 0; l < nnz; l++) {
-      kcal = row_ind[col_ptr[i]+k];
-      lcal = row_ind[col_ptr[i]+l];
-      // We now have to copy M[kcal][lcal] to submatrix[k][l]
-      // How to access M[kcal][lcal]? Calculate idx
-      idx = find_elem(kcal, &(row_ind[col_ptr[lcal]]),
-                      col_ptr[lcal+1]-col_ptr[lcal]);
-      if (idx != -1) {
-        submatrix[k*nnz+l] = values[col_ptr[lcal] + idx];
-      }
+/* Dynamic distribution: all ranks, including rank 0, fetch chunks of columns
+ * from a shared counter on rank 0 until every column has been handed out.
+ * Chunks shrink as the work runs out (guided self-scheduling), but never
+ * below min_chunk. The results of all chunks are appended to *values_inv and
+ * the chunk boundaries to *chunks (two entries per chunk) so they can be put
+ * in place on rank 0 later on. Returns the number of result elements. */
+MKL_INT solve_dynamic(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                      MKL_INT size, MKL_INT min_chunk,
+                      struct solver_options *opts, struct workspace *ws,
+                      double **values_inv, MKL_INT **chunks, int *num_chunks,
+                      struct solve_stats *stats) {
+  MPI_Win win;
+  MKL_INT *counter, chunk, first_col, last_col, total_elem, elem_capacity;
+  int world_rank, world_size, chunk_capacity;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  MPI_Win_allocate(world_rank == 0 ? sizeof(MKL_INT) : 0, sizeof(MKL_INT),
+                   MPI_INFO_NULL, MPI_COMM_WORLD, &counter, &win);
+  if (world_rank == 0) {
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
+    *counter = 0;
+    MPI_Win_unlock(0, win);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  total_elem = 0;
+  elem_capacity = 0;
+  chunk_capacity = 0;
+  *num_chunks = 0;
+  *values_inv = NULL;
+  *chunks = NULL;
+  last_col = 0;
+
+  MPI_Win_lock_all(0, win);
+  while (1) {
+    // last_col is the latest state of the counter we know about
+    chunk = (size - last_col) / (2*world_size);
+    if (chunk < min_chunk) {
+      chunk = min_chunk;
+    }
+    MPI_Fetch_and_op(&chunk, &first_col, MPI_INT, 0, 0, MPI_SUM, win);
+    MPI_Win_flush(0, win);
+    if (first_col >= size) {
+      break;
+    }
+    last_col = first_col + chunk;
+    if (last_col > size) {
+      last_col = size;
+    }
+
+    if (*num_chunks == chunk_capacity) {
+      chunk_capacity = chunk_capacity ? 2*chunk_capacity : 64;
+      *chunks = (MKL_INT*) realloc(*chunks, 2*chunk_capacity*sizeof(MKL_INT));
+    }
+    (*chunks)[2*(*num_chunks)] = first_col;
+    (*chunks)[2*(*num_chunks)+1] = last_col;
+    (*num_chunks)++;
+
+    while (total_elem + col_ptr[last_col] - col_ptr[first_col] >
+           elem_capacity) {
+      elem_capacity = elem_capacity ? 2*elem_capacity :
+                      col_ptr[last_col] - col_ptr[first_col];
+      *values_inv = (double*) realloc(*values_inv,
+                                      elem_capacity*sizeof(double));
+    }
+    solve_columns(values, row_ind, col_ptr, &((*values_inv)[total_elem]),
+                  first_col, last_col, opts, ws, stats);
+    total_elem += col_ptr[last_col] - col_ptr[first_col];
+  }
+  MPI_Win_unlock_all(win);
+  MPI_Win_free(&win);
+
+  return total_elem;
+}
+
+/* Put the chunks from solve_dynamic, solved with the filtered matrix, into
+ * the pattern of the full one. Returns their new number of elements. */
+MKL_INT expand_dynamic(struct filter *f, double **local_inv, MKL_INT *chunks,
+                       int num_chunks) {
+  MKL_INT first_col, last_col, in_pos = 0, out_pos = 0;
+  double *expanded;
+  int c;
+
+  for (c = 0; c < num_chunks; c++) {
+    out_pos += f->full_col_ptr[chunks[2*c+1]] - f->full_col_ptr[chunks[2*c]];
+  }
+  expanded = (double*) malloc((out_pos ? out_pos : 1) * sizeof(double));
+  out_pos = 0;
+  for (c = 0; c < num_chunks; c++) {
+    first_col = chunks[2*c];
+    last_col = chunks[2*c+1];
+    filter_expand(f, first_col, last_col, &((*local_inv)[in_pos]),
+                  &(expanded[out_pos]));
+    in_pos += f->col_ptr[last_col] - f->col_ptr[first_col];
+    out_pos += f->full_col_ptr[last_col] - f->full_col_ptr[first_col];
+  }
+  free(*local_inv);
+  *local_inv = expanded;
+  return out_pos;
+}
+
+/* Counterpart of solve_dynamic: collect the chunks of all ranks on rank 0 and
+ * copy them to their place in values_inv, which therefore has the same
+ * layout as with the static distribution. values_inv is only used on rank 0. */
+void gather_dynamic(MKL_INT *col_ptr, double *local_inv, MKL_INT local_elem,
+                    MKL_INT *chunks, int num_chunks, double *values_inv) {
+  int world_rank, world_size, r, c, *chunk_counts, *elem_counts,
+      *chunk_displs, *elem_displs, total_chunks;
+  MKL_INT *all_chunks, pos, first_col, last_col;
+  double *all_inv;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  chunk_counts = NULL;
+  elem_counts = NULL;
+  chunk_displs = NULL;
+  elem_displs = NULL;
+  all_chunks = NULL;
+  all_inv = NULL;
+  num_chunks *= 2;
+
+  if (world_rank == 0) {
+    chunk_counts = (int*) calloc(world_size, sizeof(int));
+    elem_counts = (int*) calloc(world_size, sizeof(int));
+    chunk_displs = (int*) calloc(world_size, sizeof(int));
+    elem_displs = (int*) calloc(world_size, sizeof(int));
+  }
+  MPI_Gather(&num_chunks, 1, MPI_INT, chunk_counts, 1, MPI_INT, 0,
+             MPI_COMM_WORLD);
+  MPI_Gather(&local_elem, 1, MPI_INT, elem_counts, 1, MPI_INT, 0,
+             MPI_COMM_WORLD);
+  if (world_rank == 0) {
+    for (r = 1; r < world_size; r++) {
+      chunk_displs[r] = chunk_displs[r-1] + chunk_counts[r-1];
+      elem_displs[r] = elem_displs[r-1] + elem_counts[r-1];
     }
+    total_chunks = chunk_displs[world_size-1] + chunk_counts[world_size-1];
+    all_chunks = (MKL_INT*) calloc(total_chunks, sizeof(MKL_INT));
+    all_inv = (double*) calloc(elem_displs[world_size-1] +
+                               elem_counts[world_size-1], sizeof(double));
   }
-  tEnd = omp_get_wtime();
-  *locDurBuild = (tEnd - tStart);
-
-  tStart = omp_get_wtime();
-  ret = invert_matrix(submatrix, nnz);
-  tEnd = omp_get_wtime();
-  *locDurCalc = (tEnd - tStart);
-  if (ret) {
-    fprintf(stderr, "Inverting submatrix failed\n");
+  MPI_Gatherv(chunks, num_chunks, MPI_INT, all_chunks, chunk_counts,
+              chunk_displs, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Gatherv(local_inv, local_elem, MPI_DOUBLE, all_inv, elem_counts,
+              elem_displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+  if (world_rank == 0) {
+    // Chunks of each rank arrive in the order they were solved
+    for (r = 0; r < world_size; r++) {
+      pos = elem_displs[r];
+      for (c = chunk_displs[r]; c < chunk_displs[r] + chunk_counts[r];
+           c += 2) {
+        first_col = all_chunks[c];
+        last_col = all_chunks[c+1];
+        memcpy(&(values_inv[col_ptr[first_col]]), &(all_inv[pos]),
+               (col_ptr[last_col] - col_ptr[first_col])*sizeof(double));
+        pos += col_ptr[last_col] - col_ptr[first_col];
+      }
+    }
+    free(all_inv);
+    free(all_chunks);
+    free(elem_displs);
+    free(chunk_displs);
+    free(elem_counts);
+    free(chunk_counts);
   }
+}
 
-//  tStart = omp_get_wtime();
-  memcpy(values_inv,
-         &(submatrix[find_elem(i, &(row_ind[col_ptr[i]]), nnz) * nnz]),
-         nnz*sizeof(double));
-//  tEnd = omp_get_wtime();
-//  *locDurBuild += (tEnd - tStart);
+/* Instead of gather_dynamic: every rank writes the results of its chunks to
+ * path itself, each at the place col_ptr gives for it. */
+void write_dynamic(const char *path, const char *hints, MKL_INT *col_ptr,
+                   double *local_inv, MKL_INT *chunks, int num_chunks) {
+  int c, *lengths;
+  MPI_Aint *offsets;
 
-  mkl_free(submatrix);
+  lengths = (int*) malloc((num_chunks ? num_chunks : 1) * sizeof(int));
+  offsets = (MPI_Aint*) malloc((num_chunks ? num_chunks : 1) *
+                               sizeof(MPI_Aint));
+  // We took the chunks in increasing order, as a file view needs them
+  for (c = 0; c < num_chunks; c++) {
+    offsets[c] = col_ptr[chunks[2*c]];
+    lengths[c] = col_ptr[chunks[2*c+1]] - col_ptr[chunks[2*c]];
+  }
+  if (write_values(path, hints, num_chunks, lengths, offsets, local_inv,
+                   MPI_COMM_WORLD) != 0) {
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  free(offsets);
+  free(lengths);
 }
 
 int main(int argc, char* argv[]) {
@@ -142,16 +362,55 @@ int main(int argc, char* argv[]) {
   }
 
   struct properties prop;
-  int fd, world_rank, world_size, *displs, *recvcounts, mkl_threads;
-  char fn_in_val[PATHLEN], fn_in_ri[PATHLEN], fn_in_cp[PATHLEN],
-       fn_out_val[PATHLEN];
-  MKL_INT *col_ptr, *row_ind, total_nnz, i, submatrices_per_worker, total_elem,
-          my_first_col, next_first_col, submatrices_for_me;
-  double *values, *values_inv, tStart, tEnd;
-  FILE *fp;
+  int world_rank, world_size, *displs, *recvcounts;
+  char fn_in[PATHLEN], fn_out[PATHLEN], fn_out_val[PATHLEN];
+  MKL_INT *col_ptr, *row_ind, *bounds, *chunks, *dirty, total_nnz, i,
+          total_elem, my_first_col, next_first_col, submatrices_for_me,
+          num_dirty, num_cols;
+  MKL_INT *perm, *map, *new_col_ptr, *new_row_ind;
+  int opt, num_chunks, scheme = PARTITION_COST, reorder = REORDER_NONE;
+  double *values, *values_inv, *local_inv, *new_values, *solve_values,
+         tStart, tEnd;
+  struct solve_stats stats;
+  struct previous_job prev;
+  struct workspace *ws;
+  struct local_matrix local;
+  struct csc_matrix in;
+  struct mpi_input min;
+  int write_result = 0, first_elem, length;
+  MPI_Aint offset;
+  int inputs[MAX_INPUTS] = {3, 2, 1}, num_inputs = 3, reps = 5, warmup = 0;
+  char *records_path = NULL, *trace_path = NULL, *token;
+  struct bench_file records;
+  struct bench_record rec, *all_recs;
+  double tDist, tTrace, imbalance;
+  struct residual res;
+  struct filter filt;
+  double filter_threshold = .0, *expanded;
+  int filter_relative = 0;
 
   MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
   MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  prop.min_chunk = 0;
+  prop.tolerance = -1.;
+  prop.distribution = DIST_BCAST;
+  prop.io_hints[0] = '\0';
+  prop.output = OUTPUT_GATHER;
+  prop.out_hints[0] = '\0';
+  memset(&prev, 0, sizeof(prev));
+  submatrix_default_options(&prop.solver);
+  prop.float_values = 0;
+  prop.records = 0;
+  prop.trace = 0;
+  prop.residual = RESIDUAL_NONE;
+  prop.residual_samples = 0;
+  prop.filter = .0;
+  prop.filter_keep = 0;
+  bounds = NULL;
+  displs = NULL;
+  recvcounts = NULL;
+  my_first_col = 0;
+  next_first_col = 0;
 
   // printf("%d: I'm alive\n", world_rank);
 
@@ -164,63 +423,423 @@ int main(int argc, char* argv[]) {
  **************/
 
     // We are the boot process. Decide on what to do, broadcast and gather.
-    if (argc != 4) {
+    while ((opt = getopt(argc, argv,
+                         "P:D:A:S:p:G:I:B:T:F:HM:O:R:Wn:r:w:J:X:V:Z:")) != -1) {
+      switch (opt) {
+        case 'P':
+          if (strcmp(optarg, "count") == 0) {
+            scheme = PARTITION_COUNT;
+          } else if (strcmp(optarg, "cost") == 0) {
+            scheme = PARTITION_COST;
+          } else {
+            scheme = -1;
+          }
+          break;
+        case 'D':
+          prop.min_chunk = strtol(optarg, NULL, 10);
+          if (prop.min_chunk < 1) {
+            scheme = -1;
+          }
+          break;
+        case 'A':
+          if (strcmp(optarg, "merge") == 0) {
+            prop.solver.assembly = ASSEMBLY_MERGE;
+          } else if (strcmp(optarg, "search") == 0) {
+            prop.solver.assembly = ASSEMBLY_SEARCH;
+          } else {
+            scheme = -1;
+          }
+          break;
+        case 'S':
+          if (strcmp(optarg, "inverse") == 0) {
+            prop.solver.method = SOLVER_INVERSE;
+          } else if (strcmp(optarg, "lu") == 0) {
+            prop.solver.method = SOLVER_LU;
+          } else if (strcmp(optarg, "cholesky") == 0) {
+            prop.solver.method = SOLVER_CHOLESKY;
+          } else if (strcmp(optarg, "eigen") == 0) {
+            prop.solver.method = SOLVER_EIGEN;
+          } else {
+            scheme = -1;
+          }
+          break;
+        case 'p':
+          prop.solver.p = strtol(optarg, NULL, 10);
+          if (prop.solver.p < 1) {
+            scheme = -1;
+          }
+          break;
+        case 'G':
+          prop.solver.group = 1;
+          prop.solver.group_growth = strtol(optarg, NULL, 10);
+          break;
+        case 'I':
+          prop.tolerance = strtod(optarg, NULL);
+          if (prop.tolerance < 0) {
+            scheme = -1;
+          }
+          break;
+        case 'B':
+          prop.solver.batch_max_dim = strtol(optarg, NULL, 10);
+          break;
+        case 'T':
+          prop.solver.large_dim = strtol(optarg, NULL, 10);
+          if (prop.solver.large_dim < 0) {
+            scheme = -1;
+          }
+          break;
+        case 'F':
+          // float: mixed precision, and the values are sent as float, too
+          if (strcmp(optarg, "double") == 0) {
+            prop.solver.precision = PRECISION_DOUBLE;
+          } else if (strcmp(optarg, "mixed") == 0) {
+            prop.solver.precision = PRECISION_MIXED;
+          } else if (strcmp(optarg, "float") == 0) {
+            prop.solver.precision = PRECISION_MIXED;
+            prop.float_values = 1;
+          } else {
+            scheme = -1;
+          }
+          break;
+        case 'H':
+          prop.distribution = DIST_HALO;
+          break;
+        case 'M':
+          // MPI-IO hints as key=value[,key=value...], or "default" for none
+          prop.distribution = DIST_MPIIO;
+          if (strlen(optarg) >= HINTS_LEN) {
+            scheme = -1;
+          }
+          strncpy(prop.io_hints, optarg, HINTS_LEN-1);
+          prop.io_hints[HINTS_LEN-1] = '\0';
+          break;
+        case 'O':
+          // gather, or mpiio with optional hints as in mpiio:key=value,...
+          if (strcmp(optarg, "gather") == 0) {
+            prop.output = OUTPUT_GATHER;
+          } else if (strncmp(optarg, "mpiio", 5) == 0 &&
+                     (optarg[5] == '\0' || optarg[5] == ':') &&
+                     strlen(optarg) < HINTS_LEN + 6) {
+            prop.output = OUTPUT_MPIIO;
+            strncpy(prop.out_hints, optarg[5] ? optarg + 6 : "",
+                    HINTS_LEN-1);
+            prop.out_hints[HINTS_LEN-1] = '\0';
+          } else {
+            scheme = -1;
+          }
+          break;
+        case 'W':
+          write_result = 1;
+          break;
+        case 'n':
+          // The n of the input files to cycle through, as in 3,2,1
+          num_inputs = 0;
+          for (token = strtok(optarg, ","); token; token = strtok(NULL, ",")) {
+            if (num_inputs == MAX_INPUTS) {
+              scheme = -1;
+              break;
+            }
+            inputs[num_inputs++] = strtol(token, NULL, 10);
+          }
+          if (num_inputs == 0) {
+            scheme = -1;
+          }
+          break;
+        case 'r':
+          reps = strtol(optarg, NULL, 10);
+          if (reps < 1) {
+            scheme = -1;
+          }
+          break;
+        case 'w':
+          warmup = strtol(optarg, NULL, 10);
+          if (warmup < 0) {
+            scheme = -1;
+          }
+          break;
+        case 'J':
+          // Records of every rank and job, CSV for *.csv, JSON lines else
+          records_path = optarg;
+          break;
+        case 'X':
+          // Timeline of all threads and ranks as a Chrome trace
+          trace_path = optarg;
+          break;
+        case 'V':
+          // Estimate ||X^p A - I|| from columns or random vectors
+          if (strncmp(optarg, "columns:", 8) == 0) {
+            prop.residual = RESIDUAL_COLUMNS;
+            prop.residual_samples = strtol(optarg + 8, NULL, 10);
+          } else if (strncmp(optarg, "probe:", 6) == 0) {
+            prop.residual = RESIDUAL_PROBE;
+            prop.residual_samples = strtol(optarg + 6, NULL, 10);
+          }
+          if (prop.residual_samples < 1) {
+            scheme = -1;
+          }
+          break;
+        case 'Z':
+          // Drop entries below the threshold, or below the threshold times
+          // the largest one, from the patterns: abs|rel:threshold[:keep]
+          if (strncmp(optarg, "abs:", 4) == 0 ||
+              strncmp(optarg, "rel:", 4) == 0) {
+            filter_relative = optarg[0] == 'r';
+            filter_threshold = strtod(optarg + 4, &token);
+            prop.filter_keep = strcmp(token, ":keep") == 0;
+            if (*token && !prop.filter_keep) {
+              scheme = -1;
+            }
+          }
+          if (filter_threshold <= 0) {
+            scheme = -1;
+          }
+          break;
+        case 'R':
+          if (strcmp(optarg, "none") == 0) {
+            reorder = REORDER_NONE;
+          } else if (strcmp(optarg, "rcm") == 0) {
+            reorder = REORDER_RCM;
+          } else {
+            scheme = -1;
+          }
+          break;
+        default:
+          scheme = -1;
+      }
+    }
+    if (argc - optind != 3 || scheme < 0) {
       fprintf(stderr,
-        "%d: Main process needs to be called with parameters size density "
-        "condition\n", world_rank);
+        "%d: Main process needs to be called with parameters "
+        "[-P count|cost] [-D min_chunk] [-A merge|search] "
+        "[-S inverse|lu|cholesky|eigen] [-p root] [-G growth] [-I tolerance] "
+        "[-B max_dim] [-T large_dim] [-F double|mixed|float] [-H] "
+        "[-M default|hints] "
+        "[-O gather|mpiio[:hints]] [-R none|rcm] [-W] [-n inputs] [-r reps] "
+        "[-w warmup] [-J records.json|records.csv] [-X trace.json] "
+        "[-V columns:samples|probe:samples] [-Z abs|rel:threshold[:keep]] "
+        "size density condition\n", world_rank);
 
       // printf("%d: Shutting down workers...\n", world_rank);
       prop.size = 0;
-      MPI_Bcast(&prop, 3, MPI_INT, 0, MPI_COMM_WORLD);
+      MPI_Bcast(&prop, sizeof(prop), MPI_BYTE, 0, MPI_COMM_WORLD);
 
       exit(EXIT_FAILURE);
     }
-    prop.size = strtol(argv[1], NULL, 10);
-    prop.density = strtol(argv[2], NULL, 10);
-    prop.condition = strtol(argv[3], NULL, 10);
+    if (prop.tolerance >= 0 && prop.min_chunk) {
+      fprintf(stderr, "%d: WARNING: Incremental updates need the static "
+              "distribution. Ignoring -I.\n", world_rank);
+      prop.tolerance = -1.;
+    }
+    if (prop.tolerance >= 0 && filter_threshold > 0) {
+      fprintf(stderr, "%d: WARNING: Incremental updates do not work with "
+              "filtered patterns. Ignoring -I.\n", world_rank);
+      prop.tolerance = -1.;
+    }
+    if (prop.tolerance >= 0 && prop.solver.group) {
+      fprintf(stderr, "%d: WARNING: Incremental updates solve each changed "
+              "column on its own. Ignoring -G.\n", world_rank);
+      prop.solver.group = 0;
+    }
+    if (prop.distribution == DIST_MPIIO && filter_relative) {
+      fprintf(stderr, "%d: WARNING: Relative thresholds need the matrix on "
+              "rank 0 before the workers read it. Ignoring -M.\n",
+              world_rank);
+      prop.distribution = DIST_BCAST;
+    }
+    if (!filter_relative) {
+      prop.filter = filter_threshold;
+    }
+#ifdef USE_BEEGFS
+    if (prop.distribution != DIST_BCAST) {
+      fprintf(stderr, "%d: WARNING: Workers read the matrix themselves with "
+              "USE_BEEGFS. Ignoring -%c.\n", world_rank,
+              prop.distribution == DIST_HALO ? 'H' : 'M');
+      prop.distribution = DIST_BCAST;
+    }
+    if (reorder != REORDER_NONE) {
+      fprintf(stderr, "%d: WARNING: Workers read the matrix themselves with "
+              "USE_BEEGFS. Ignoring -R.\n", world_rank);
+      reorder = REORDER_NONE;
+    }
+#endif
+    if (prop.distribution != DIST_BCAST && prop.min_chunk) {
+      fprintf(stderr, "%d: WARNING: Halo distribution needs the static "
+              "distribution. Ignoring -%c.\n", world_rank,
+              prop.distribution == DIST_HALO ? 'H' : 'M');
+      prop.distribution = DIST_BCAST;
+    }
+    if (prop.distribution == DIST_MPIIO && reorder != REORDER_NONE) {
+      fprintf(stderr, "%d: WARNING: Workers read the matrix as stored with "
+              "-M. Ignoring -R.\n", world_rank);
+      reorder = REORDER_NONE;
+    }
+    if (prop.output == OUTPUT_MPIIO && write_result) {
+      fprintf(stderr, "%d: WARNING: Results stay on the workers with -O "
+              "mpiio. Ignoring -W.\n", world_rank);
+      write_result = 0;
+    }
+    if (prop.output == OUTPUT_MPIIO && prop.residual != RESIDUAL_NONE) {
+      fprintf(stderr, "%d: WARNING: Results stay on the workers with -O "
+              "mpiio. Ignoring -V.\n", world_rank);
+      prop.residual = RESIDUAL_NONE;
+    }
+    if (prop.output == OUTPUT_MPIIO && reorder != REORDER_NONE) {
+      fprintf(stderr, "%d: WARNING: Workers write the results in the order "
+              "they solved them with -O mpiio. Ignoring -R.\n", world_rank);
+      reorder = REORDER_NONE;
+    }
+    if (prop.solver.p > 1) {
+      // Roots other than the plain inverse need the eigendecomposition
+      prop.solver.method = SOLVER_EIGEN;
+    }
+    if (prop.solver.precision == PRECISION_MIXED &&
+        prop.solver.method != SOLVER_LU &&
+        prop.solver.method != SOLVER_CHOLESKY) {
+      fprintf(stderr, "%d: WARNING: Mixed precision needs -S lu or -S "
+              "cholesky. Ignoring -F.\n", world_rank);
+      prop.solver.precision = PRECISION_DOUBLE;
+      prop.float_values = 0;
+    }
+    if (prop.solver.precision == PRECISION_MIXED &&
+        prop.solver.batch_max_dim > 0) {
+      fprintf(stderr, "%d: WARNING: The batched kernels only factor in "
+              "double precision. Ignoring -B.\n", world_rank);
+      prop.solver.batch_max_dim = 0;
+    }
+#ifndef USE_BEEGFS
+    if (prop.float_values && prop.distribution != DIST_BCAST) {
+#else
+    if (prop.float_values) {
+#endif
+      fprintf(stderr, "%d: WARNING: Only the broadcast sends values as "
+              "float. Using -F mixed.\n", world_rank);
+      prop.float_values = 0;
+    }
+    prop.size = strtol(argv[optind], NULL, 10);
+    prop.density = strtol(argv[optind+1], NULL, 10);
+    prop.condition = strtol(argv[optind+2], NULL, 10);
+    all_recs = NULL;
+    if (records_path) {
+      if (bench_open(records_path, &records) != 0) {
+        prop.size = 0;
+        MPI_Bcast(&prop, sizeof(prop), MPI_BYTE, 0, MPI_COMM_WORLD);
+        exit(EXIT_FAILURE);
+      }
+      prop.records = 1;
+      all_recs = (struct bench_record*) calloc(world_size,
+                                               sizeof(struct bench_record));
+    }
+    if (trace_path) {
+      prop.trace = 1;
+      trace_init();
+    }
 
-    submatrices_per_worker = prop.size / (world_size-1);
-    printf("%d: Each of the %d workers will solve %d submatrices.\n",
-      world_rank, (world_size-1), submatrices_per_worker);
-    if (prop.size % (world_size-1) != 0) {
-      fprintf(stderr, "%d: WARNING: Load imbalanced. Last worker will have to "
-              "solve %d additional submatrices\n", world_rank,
-              prop.size % (world_size-1));
+    printf("%d: Computing the inverse p-th root with p = %d.\n", world_rank,
+           prop.solver.p);
+    if (prop.min_chunk) {
+      printf("%d: Columns are handed out dynamically to all %d ranks in "
+             "chunks of at least %d columns.\n", world_rank, world_size,
+             prop.min_chunk);
+    } else {
+      printf("%d: Columns are split over the %d workers by %s.\n",
+             world_rank, (world_size-1), scheme == PARTITION_COST ?
+             "estimated submatrix cost" : "count");
+    }
+    if (prop.solver.precision == PRECISION_MIXED) {
+      printf("%d: Submatrices are factored in single precision and refined "
+             "to double accuracy%s.\n", world_rank, prop.float_values ?
+             ", values are broadcast as float" : "");
+    }
+    if (filter_threshold > 0) {
+      printf("%d: Entries below %e%s are dropped from the submatrix "
+             "patterns%s.\n", world_rank, filter_threshold, filter_relative ?
+             " times the largest one" : "", prop.filter_keep ?
+             ", but their values stay in the submatrices" : "");
+    }
+    if (prop.residual == RESIDUAL_COLUMNS) {
+      printf("%d: The residual X^p A - I is estimated from %d sampled "
+             "columns after each job.\n", world_rank, prop.residual_samples);
+    } else if (prop.residual == RESIDUAL_PROBE) {
+      printf("%d: The residual X^p A - I is estimated from %d random "
+             "vectors after each job.\n", world_rank, prop.residual_samples);
+    }
+    if (prop.solver.large_dim < 0) {
+      printf("%d: Submatrices too large for one thread are picked per rank "
+             "and solved first with all threads in MKL.\n", world_rank);
+    } else if (prop.solver.large_dim > 0) {
+      printf("%d: Submatrices above dimension %d are solved first with all "
+             "threads in MKL.\n", world_rank, prop.solver.large_dim);
     }
 
 
 /* Main evaluation loop */
 
-    int evalRep, evalChoice;
-    
-    for (evalRep = 0; evalRep < 5; evalRep++) {
-      for (evalChoice = 3; evalChoice > 0; evalChoice--) {
+    int evalRep, evalChoice, input, job, round;
 
-        snprintf(fn_in_cp, PATHLEN, "sprandsym-s%d-d%d-c%d-n%d.cp", prop.size,
-                 prop.density, prop.condition, evalChoice);
+    if (warmup + reps > 1 || num_inputs > 1) {
+      printf("%d: Solving %d input(s) %d times each, the first %d as warm-up."
+             "\n", world_rank, num_inputs, warmup + reps, warmup);
+    }
+    for (evalRep = 0; evalRep < warmup + reps; evalRep++) {
+      for (evalChoice = 0; evalChoice < num_inputs; evalChoice++) {
+
+        /* Incremental updates only help if the same input comes several times
+         * in a row, so in that case we repeat each input before moving on. */
+        job = evalRep * num_inputs + evalChoice;
+        input = prop.tolerance < 0 ? inputs[evalChoice] :
+                inputs[job / (warmup + reps)];
+        round = prop.tolerance < 0 ? evalRep : job % (warmup + reps);
+        memset(&stats, 0, sizeof(stats));
+
+        snprintf(fn_in, PATHLEN, "sprandsym-s%d-d%d-c%d-n%d", prop.size,
+                 prop.density, prop.condition, input);
+        snprintf(fn_out, PATHLEN, "sprandsym-s%d-d%d-c%d-n%d.inv",
+                 prop.size, prop.density, prop.condition, input);
         snprintf(fn_out_val, PATHLEN, "sprandsym-s%d-d%d-c%d-n%d.inv.val",
-                 prop.size, prop.density, prop.condition, evalChoice);
-        snprintf(fn_in_val, PATHLEN, "sprandsym-s%d-d%d-c%d-n%d.val", prop.size,
-                 prop.density, prop.condition, evalChoice);
-        snprintf(fn_in_ri, PATHLEN, "sprandsym-s%d-d%d-c%d-n%d.ri", prop.size,
-                 prop.density, prop.condition, evalChoice);
+                 prop.size, prop.density, prop.condition, input);
 
+        prop.input = input;
 
-        col_ptr = (MKL_INT*) calloc(prop.size+1, sizeof(MKL_INT));
-        fp = fopen(fn_in_cp, "rb");
-        fread(col_ptr, sizeof(MKL_INT), prop.size+1, fp);
-        fclose(fp);
-        
-        total_nnz = col_ptr[prop.size];
-        row_ind = (MKL_INT*) calloc(total_nnz, sizeof(MKL_INT));
-        fp = fopen(fn_in_ri, "rb");
-        fread(row_ind, sizeof(MKL_INT), total_nnz, fp);
-        fclose(fp);
-        
-        values = (double*) calloc(total_nnz, sizeof(double));
-        fp = fopen(fn_in_val, "rb");
-        fread(values, sizeof(double), total_nnz, fp);
-        fclose(fp);
+        tTrace = trace_clock();
+        if (prop.distribution == DIST_MPIIO) {
+          // The workers open the input with us, we only need col_ptr
+          MPI_Bcast(&prop, sizeof(prop), MPI_BYTE, 0, MPI_COMM_WORLD);
+          if (mpi_input_open(fn_in, prop.io_hints, MPI_COMM_WORLD, &min) != 0
+              || min.size != prop.size) {
+            fprintf(stderr, "%d: Cannot read a matrix of size %d from %s\n",
+                    world_rank, prop.size, fn_in);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+          }
+          col_ptr = (MKL_INT*) calloc(prop.size+1, sizeof(MKL_INT));
+          mpi_input_col_ptr(&min, 0, prop.size+1, col_ptr);
+          row_ind = NULL;
+          values = NULL;
+          total_nnz = min.nnz;
+          if (write_result || prop.residual != RESIDUAL_NONE ||
+              prop.filter > 0) {
+            row_ind = (MKL_INT*) calloc(total_nnz, sizeof(MKL_INT));
+            mpi_input_row_ind(&min, row_ind);
+          }
+          if (prop.residual != RESIDUAL_NONE || prop.filter > 0) {
+            values = (double*) calloc(total_nnz, sizeof(double));
+            mpi_input_values(&min, values);
+          }
+        } else {
+          // The container if there is one, otherwise the .cp/.ri/.val files
+          if (csc_read(fn_in, CSC_VERIFY | CSC_COPY, &in) != 0 ||
+              in.size != prop.size) {
+            fprintf(stderr, "%d: Cannot read a matrix of size %d from %s\n",
+                    world_rank, prop.size, fn_in);
+            prop.size = 0;
+            MPI_Bcast(&prop, sizeof(prop), MPI_BYTE, 0, MPI_COMM_WORLD);
+            exit(EXIT_FAILURE);
+          }
+          col_ptr = in.col_ptr;
+          row_ind = in.row_ind;
+          values = in.values;
+          total_nnz = in.nnz;
+        }
+        trace_event(TRACE_READ, input, prop.size, 1, tTrace, trace_clock());
     
 /*      fp = fopen(fn_out_val, "wb");
         fseek(fp, total_nnz*sizeof(double)-1, SEEK_SET);
@@ -232,52 +851,260 @@ int main(int argc, char* argv[]) {
                                     PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
         close(fd);
 */
-        values_inv = (double*) calloc(total_nnz, sizeof(double));
-
-        displs = (int*) calloc(world_size, sizeof(int));
-        recvcounts = (int*) calloc(world_size, sizeof(int));
-        for (i = 1; i < world_size; i++) {
-          displs[i] = col_ptr[(i-1)*submatrices_per_worker];
-          recvcounts[i] = col_ptr[i*submatrices_per_worker] -
-                          col_ptr[(i-1)*submatrices_per_worker];
+        if (reorder == REORDER_RCM) {
+          // Solve the reordered matrix instead. The original stays in in for
+          // putting the results back in its order at the end.
+          tStart = MPI_Wtime();
+          perm = (MKL_INT*) malloc(prop.size * sizeof(MKL_INT));
+          map = (MKL_INT*) malloc(total_nnz * sizeof(MKL_INT));
+          new_col_ptr = (MKL_INT*) calloc(prop.size+1, sizeof(MKL_INT));
+          new_row_ind = (MKL_INT*) calloc(total_nnz, sizeof(MKL_INT));
+          new_values = (double*) calloc(total_nnz, sizeof(double));
+          rcm_permutation(col_ptr, row_ind, prop.size, perm);
+          permute_matrix(col_ptr, row_ind, values, prop.size, perm,
+                         new_col_ptr, new_row_ind, new_values, map);
+          tEnd = MPI_Wtime();
+
+          printf("%d: Wall time elapsed for reordering: %dms\n", world_rank,
+                 (int)((tEnd-tStart)*1000));
+          print_reordering(col_ptr, row_ind, new_col_ptr, new_row_ind,
+                           prop.size, prop.min_chunk ? world_size :
+                           world_size-1, scheme);
+          free(perm);
+          col_ptr = new_col_ptr;
+          row_ind = new_row_ind;
+          values = new_values;
+        }
+
+        if (filter_relative) {
+          prop.filter = filter_threshold * filter_max(total_nnz, values);
+        }
+
+        // With -O mpiio the results never come to us
+        values_inv = NULL;
+        if (prop.output == OUTPUT_GATHER) {
+          values_inv = (double*) calloc(total_nnz, sizeof(double));
+        }
+
+        if (!prop.min_chunk) {
+          // Worker i solves the columns bounds[i-1] to bounds[i]-1
+          bounds = (MKL_INT*) calloc(world_size, sizeof(MKL_INT));
+          if (prop.filter > 0) {
+            // The workers filter their parts alike, balance what they solve
+            filter_matrix(prop.size, col_ptr, row_ind, values, prop.filter,
+                          &filt);
+            print_filter(world_rank, &filt, prop.filter_keep, &prop.solver);
+            partition_columns(filt.col_ptr, prop.size, world_size-1, scheme,
+                              bounds);
+            print_partition(filt.col_ptr, world_size-1, bounds, 1);
+            free_filter(&filt);
+          } else {
+            partition_columns(col_ptr, prop.size, world_size-1, scheme,
+                              bounds);
+            print_partition(col_ptr, world_size-1, bounds, 1);
+          }
+
+          displs = (int*) calloc(world_size, sizeof(int));
+          recvcounts = (int*) calloc(world_size, sizeof(int));
+          for (i = 1; i < world_size; i++) {
+            displs[i] = col_ptr[bounds[i-1]];
+            recvcounts[i] = col_ptr[bounds[i]] - col_ptr[bounds[i-1]];
+          }
         }
-        // Allow last worker to send all remaining results
-        recvcounts[world_size-1] = col_ptr[prop.size] -
-                                   col_ptr[(world_size-2) * submatrices_per_worker];
 
 
         tStart = MPI_Wtime();
+        tTrace = trace_clock();
         // printf("%d: Broadcasting information to all workers...\n", world_rank);
-        MPI_Bcast(&prop, 3, MPI_INT, 0, MPI_COMM_WORLD);
+        if (prop.distribution != DIST_MPIIO) {
+          MPI_Bcast(&prop, sizeof(prop), MPI_BYTE, 0, MPI_COMM_WORLD);
+        }
+        if (!prop.min_chunk) {
+          MPI_Bcast(bounds, world_size, MPI_INT, 0, MPI_COMM_WORLD);
+        }
         // printf("%d: ... done\n", world_rank);
 
+        if (prop.distribution == DIST_MPIIO) {
+          // Take part in the collective reads without reading anything
+          mpi_input_local(&min, 0, 0, &local);
+          free_local(&local);
+          mpi_input_close(&min);
+          mpi_input_report(&min, MPI_COMM_WORLD);
+        }
 #ifndef USE_BEEGFS
         // Send data to all workers
-        MPI_Bcast(col_ptr, prop.size+1, MPI_INT, 0, MPI_COMM_WORLD);
-        MPI_Bcast(row_ind, total_nnz, MPI_INT, 0, MPI_COMM_WORLD);
-        MPI_Bcast(values, total_nnz, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        if (prop.distribution == DIST_HALO) {
+          send_halos(col_ptr, row_ind, values, prop.size, bounds,
+                     world_size-1, MPI_COMM_WORLD);
+        } else if (prop.distribution == DIST_BCAST) {
+          MPI_Bcast(col_ptr, prop.size+1, MPI_INT, 0, MPI_COMM_WORLD);
+          MPI_Bcast(row_ind, total_nnz, MPI_INT, 0, MPI_COMM_WORLD);
+          bcast_values(values, total_nnz, prop.float_values);
+        }
 #endif
         tEnd = MPI_Wtime();
+        memset(&rec, 0, sizeof(rec));
+        rec.dist = tEnd - tStart;
+        trace_event(TRACE_DISTRIBUTE, input, prop.size, 1, tTrace,
+                    trace_clock());
 
-        printf("%d: Wall time elapsed for Bcast: %dms\n", world_rank,
+        printf("%d: Wall time elapsed for %s: %dms\n", world_rank,
+               prop.distribution == DIST_MPIIO ? "MPI-IO input" :
+               prop.distribution == DIST_HALO ? "halo distribution" : "Bcast",
                (int)((tEnd-tStart)*1000));
       
 
-        tStart = MPI_Wtime();
-        // printf("%d: Waiting for results...\n", world_rank);
-        MPI_Gatherv(NULL, 0, MPI_DOUBLE, values_inv, recvcounts, displs,
-                    MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        // printf("%d: ... done\n", world_rank);
-        tEnd = MPI_Wtime();
+        if (prop.min_chunk) {
+          // With dynamic distribution we take our share of the work, too
+          mkl_set_num_threads(1);
+          memset(&stats, 0, sizeof(stats));
+          if (prop.filter > 0) {
+            // After the Bcast, which rounds our values with -F float
+            filter_matrix(prop.size, col_ptr, row_ind, values, prop.filter,
+                          &filt);
+            print_filter(world_rank, &filt, prop.filter_keep, &prop.solver);
+            col_ptr = filt.col_ptr;
+            row_ind = filt.row_ind;
+            values = filt.values;
+          }
+          ws = create_workspaces(omp_get_max_threads(),
+                                 max_column_length(col_ptr, 0, prop.size),
+                                 &prop.solver);
+          if (prop.filter > 0 && prop.filter_keep) {
+            filter_keep_values(&filt, ws, omp_get_max_threads());
+          }
+          tStart = MPI_Wtime();
+          tTrace = trace_clock();
+          total_elem = solve_dynamic(values, row_ind, col_ptr, prop.size,
+                                     prop.min_chunk, &prop.solver, ws,
+                                     &local_inv, &chunks, &num_chunks,
+                                     &stats);
+          tEnd = MPI_Wtime();
+          trace_event(TRACE_SOLVE, input, prop.size, 1, tTrace, trace_clock());
+          collect_workspaces(ws, omp_get_max_threads(), &stats);
+          free_workspaces(ws, omp_get_max_threads());
+
+          printf("%d: Solved %d columns in %d chunks.\n", world_rank,
+                 stats.columns, num_chunks);
+          print_solve_stats(world_rank, &prop.solver, &stats, tStart, tEnd);
+          rec.wall = tEnd - tStart;
+          if (prop.filter > 0) {
+            total_elem = expand_dynamic(&filt, &local_inv, chunks,
+                                        num_chunks);
+            col_ptr = filt.full_col_ptr;
+            row_ind = filt.full_row_ind;
+            values = filt.full_values;
+            free_filter(&filt);
+          }
 
-        printf("%d: Wall time elapsed for Gatherv: %dms\n", world_rank,
+          tStart = MPI_Wtime();
+          tTrace = trace_clock();
+          if (prop.output == OUTPUT_MPIIO) {
+            write_dynamic(fn_out_val, prop.out_hints, col_ptr, local_inv,
+                          chunks, num_chunks);
+          } else {
+            gather_dynamic(col_ptr, local_inv, total_elem, chunks, num_chunks,
+                           values_inv);
+          }
+          tEnd = MPI_Wtime();
+          free(chunks);
+          free(local_inv);
+        } else {
+          tStart = MPI_Wtime();
+          tTrace = trace_clock();
+          if (prop.output == OUTPUT_MPIIO) {
+            // Tell the workers where their results go in the file
+            MPI_Scatter(displs, 1, MPI_INT, MPI_IN_PLACE, 1, MPI_INT, 0,
+                        MPI_COMM_WORLD);
+            if (write_values(fn_out_val, prop.out_hints, 0, NULL, NULL, NULL,
+                             MPI_COMM_WORLD) != 0) {
+              MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+          } else {
+            // printf("%d: Waiting for results...\n", world_rank);
+            MPI_Gatherv(NULL, 0, MPI_DOUBLE, values_inv, recvcounts, displs,
+                        MPI_DOUBLE, 0, MPI_COMM_WORLD);
+            // printf("%d: ... done\n", world_rank);
+          }
+          tEnd = MPI_Wtime();
+          free(recvcounts);
+          free(displs);
+          free(bounds);
+        }
+
+        trace_event(TRACE_OUTPUT, input, prop.size, 1, tTrace, trace_clock());
+        printf("%d: Wall time elapsed for %s: %dms\n", world_rank,
+               prop.output == OUTPUT_MPIIO ? "MPI-IO output" : "Gatherv",
                (int)((tEnd-tStart)*1000));
+        rec.gather = tEnd - tStart;
+
+        if (reorder == REORDER_RCM) {
+          new_values = values_inv;
+          values_inv = (double*) calloc(total_nnz, sizeof(double));
+          unpermute_values(new_values, total_nnz, map, values_inv);
+          free(new_values);
+          free(map);
+          free(col_ptr);
+          free(row_ind);
+          free(values);
+          col_ptr = in.col_ptr;
+          row_ind = in.row_ind;
+          values = in.values;
+        }
+
+        memset(&res, 0, sizeof(res));
+        if (prop.residual != RESIDUAL_NONE) {
+          tTrace = trace_clock();
+          check_residual(&prop, col_ptr, row_ind, values, values_inv, &res);
+          trace_event(TRACE_RESIDUAL, input, prop.size, 1, tTrace,
+                      trace_clock());
+          if (prop.residual == RESIDUAL_COLUMNS) {
+            printf("%d: Residual from %d sampled columns: ||X^p A - I||_F "
+                   "~ %e, ||X^p A - I||_2 >= %e, %dms\n", world_rank,
+                   prop.residual_samples, res.frobenius, res.spectral,
+                   (int)(res.time*1000));
+          } else {
+            printf("%d: Residual from %d random vectors: ||X^p A - I||_F "
+                   "~ %e, ||X^p A - I||_2 ~ %e, %dms\n", world_rank,
+                   prop.residual_samples, res.frobenius, res.spectral,
+                   (int)(res.time*1000));
+          }
+        }
+
+        if (prop.records) {
+          fill_record(&rec, world_rank, &stats);
+          bench_gather(&rec, all_recs, MPI_COMM_WORLD);
+          imbalance = bench_imbalance(all_recs, world_size);
+          for (i = 0; i < world_size; i++) {
+            all_recs[i].size = prop.size;
+            all_recs[i].density = prop.density;
+            all_recs[i].condition = prop.condition;
+            all_recs[i].input = input;
+            all_recs[i].job = job;
+            all_recs[i].round = round;
+            all_recs[i].warmup = round < warmup;
+            all_recs[i].ranks = world_size;
+            all_recs[i].imbalance = imbalance;
+            all_recs[i].residual_f = res.frobenius;
+            all_recs[i].residual_2 = res.spectral;
+          }
+          bench_write(&records, all_recs, world_size);
+        }
+
+        if (write_result) {
+          // The result has the pattern of the input
+          tStart = MPI_Wtime();
+          csc_write(fn_out, prop.size, col_ptr, row_ind, values_inv,
+                    csc_is_symmetric(prop.size, col_ptr, row_ind,
+                                     values_inv));
+          tEnd = MPI_Wtime();
+          printf("%d: Wall time elapsed for writing %s.csc: %dms\n",
+                 world_rank, fn_out, (int)((tEnd-tStart)*1000));
+        }
        
              
         free(row_ind);
         free(values);
-        free(recvcounts);
-        free(displs);
         free(col_ptr);
         free(values_inv);
   //    munmap(values_inv, total_nnz*sizeof(double));
@@ -288,9 +1115,17 @@ int main(int argc, char* argv[]) {
 
 /* End of main evaluation loop */
 
+    if (prop.records) {
+      bench_close(&records);
+      free(all_recs);
+    }
+
     // printf("%d: Shutting down workers...\n", world_rank);
     prop.size = 0;
-    MPI_Bcast(&prop, 3, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&prop, sizeof(prop), MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (prop.trace) {
+      trace_write(trace_path, MPI_COMM_WORLD);
+    }
 
 
   } else {
@@ -306,140 +1141,275 @@ int main(int argc, char* argv[]) {
     // We are one of the workers. Run in a loop and wait for jobs.
     while (1) {
       printf("%d: Waiting for matrix properties...\n", world_rank);
-      MPI_Bcast(&prop, 3, MPI_INT, 0, MPI_COMM_WORLD);
+      MPI_Bcast(&prop, sizeof(prop), MPI_BYTE, 0, MPI_COMM_WORLD);
       printf("%d: ... received\n", world_rank);
       if (prop.size == 0) {
         printf("%d: Received signal to halt.\n", world_rank);
+        forget_job(&prev);
+        if (prop.trace) {
+          trace_write(NULL, MPI_COMM_WORLD);
+        }
         break;
       }
+      if (prop.trace) {
+        trace_init();
+      }
+      tDist = MPI_Wtime();
+      tTrace = trace_clock();
+
+      if (!prop.min_chunk && prop.distribution != DIST_MPIIO) {
+        bounds = (MKL_INT*) calloc(world_size, sizeof(MKL_INT));
+        MPI_Bcast(bounds, world_size, MPI_INT, 0, MPI_COMM_WORLD);
+      }
       
-      snprintf(fn_in_cp, PATHLEN, "sprandsym-s%d-d%d-c%d-n1.cp", prop.size,
-               prop.density, prop.condition);
-      snprintf(fn_out_val, PATHLEN, "sprandsym-s%d-d%d-c%d-n1.inv.val",
-               prop.size, prop.density, prop.condition);
-      snprintf(fn_in_val, PATHLEN, "sprandsym-s%d-d%d-c%d-n1.val", prop.size,
-               prop.density, prop.condition);
-      snprintf(fn_in_ri, PATHLEN, "sprandsym-s%d-d%d-c%d-n1.ri", prop.size,
-               prop.density, prop.condition);
+      snprintf(fn_in, PATHLEN, "sprandsym-s%d-d%d-c%d-n%d", prop.size,
+               prop.density, prop.condition, prop.input);
+      snprintf(fn_out_val, PATHLEN, "sprandsym-s%d-d%d-c%d-n%d.inv.val",
+               prop.size, prop.density, prop.condition, prop.input);
+      num_cols = prop.size;
       
 #ifdef USE_BEEGFS
 # ifdef USE_MMAP
-      fd = open(fn_in_cp, O_RDONLY);
-      col_ptr = (MKL_INT*) mmap(NULL, (prop.size+1)*sizeof(MKL_INT), PROT_READ,
-                                MAP_SHARED, fd, 0);
-      close(fd);
+      // With the container one mapping serves all three arrays
+      if (csc_read(fn_in, 0, &in) != 0) {
 # else
-      fp = fopen(fn_in_cp, "rb");
-      col_ptr = (MKL_INT*) calloc(prop.size+1, sizeof(MKL_INT));
-      fread(col_ptr, sizeof(MKL_INT), prop.size+1, fp);
-      fclose(fp);
+      if (csc_read(fn_in, CSC_COPY, &in) != 0) {
 # endif
+        fprintf(stderr, "%d: Cannot read %s\n", world_rank, fn_in);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+      }
+      col_ptr = in.col_ptr;
+      row_ind = in.row_ind;
+      values = in.values;
 #else
-      col_ptr = (MKL_INT*) calloc(prop.size+1, sizeof(MKL_INT));
-      MPI_Bcast(col_ptr, prop.size+1, MPI_INT, 0, MPI_COMM_WORLD);
+      if (prop.distribution == DIST_MPIIO) {
+        // Read our halo ourselves, which gives the same local matrix as -H.
+        // Rank 0 reads col_ptr for the partition meanwhile.
+        if (mpi_input_open(fn_in, prop.io_hints, MPI_COMM_WORLD, &min) != 0) {
+          fprintf(stderr, "%d: Cannot read %s\n", world_rank, fn_in);
+          MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        mpi_input_col_ptr(&min, 0, 0, NULL);
+        bounds = (MKL_INT*) calloc(world_size, sizeof(MKL_INT));
+        MPI_Bcast(bounds, world_size, MPI_INT, 0, MPI_COMM_WORLD);
+        mpi_input_local(&min, bounds[world_rank-1], bounds[world_rank],
+                        &local);
+        mpi_input_close(&min);
+        mpi_input_report(&min, MPI_COMM_WORLD);
+        num_cols = local.size;
+        col_ptr = local.col_ptr;
+      } else if (prop.distribution == DIST_HALO) {
+        // Only our halo, with columns and rows in local numbering
+        recv_local(&local, 0, MPI_COMM_WORLD);
+        num_cols = local.size;
+        col_ptr = local.col_ptr;
+      } else {
+        col_ptr = (MKL_INT*) calloc(prop.size+1, sizeof(MKL_INT));
+        MPI_Bcast(col_ptr, prop.size+1, MPI_INT, 0, MPI_COMM_WORLD);
+      }
 #endif
       
-      total_nnz = col_ptr[prop.size];
-#ifdef USE_BEEGFS
-# ifdef USE_MMAP
-      fd = open(fn_in_ri, O_RDONLY);
-      row_ind = (MKL_INT*) mmap(NULL, total_nnz*sizeof(MKL_INT), PROT_READ,
-                                MAP_SHARED, fd, 0);
-      close(fd);
-      fd = open(fn_in_val, O_RDONLY);
-      values = (double*) mmap(NULL, total_nnz*sizeof(double), PROT_READ,
-                              MAP_SHARED, fd, 0);
-      close(fd);
-# else
-      row_ind = (MKL_INT*) calloc(total_nnz, sizeof(MKL_INT));
-      values = (double*) calloc(total_nnz, sizeof(double));
-      fp = fopen(fn_in_ri, "rb");
-      fread(row_ind, sizeof(MKL_INT), total_nnz, fp);
-      fclose(fp);
-      fp = fopen(fn_in_val, "rb");
-      fread(values, sizeof(double), total_nnz, fp);
-      fclose(fp);
-# endif
-#else
-      row_ind = (MKL_INT*) calloc(total_nnz, sizeof(MKL_INT));
-      values = (double*) calloc(total_nnz, sizeof(double));
-      MPI_Bcast(row_ind, total_nnz, MPI_INT, 0, MPI_COMM_WORLD);
-      MPI_Bcast(values, total_nnz, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-#endif
-
-      submatrices_per_worker = prop.size / (world_size-1);
-      my_first_col = (world_rank-1)*submatrices_per_worker;
-      if (world_rank == world_size-1) {
-        // We are the last worker. Maybe we have to do additional work...
-        submatrices_for_me = submatrices_per_worker +
-                             (prop.size % (world_size-1));
-        next_first_col = prop.size;
-        
+      total_nnz = col_ptr[num_cols];
+#ifndef USE_BEEGFS
+      if (prop.distribution != DIST_BCAST) {
+        row_ind = local.row_ind;
+        values = local.values;
       } else {
-        submatrices_for_me = submatrices_per_worker;
-        next_first_col = world_rank*submatrices_per_worker;
+        row_ind = (MKL_INT*) calloc(total_nnz, sizeof(MKL_INT));
+        values = (double*) calloc(total_nnz, sizeof(double));
+        MPI_Bcast(row_ind, total_nnz, MPI_INT, 0, MPI_COMM_WORLD);
+        bcast_values(values, total_nnz, prop.float_values);
       }
-      total_elem = col_ptr[next_first_col] - col_ptr[my_first_col];
-      values_inv = (double*) calloc(total_elem, sizeof(double));
-
-      /* Optimize threading: We should do as much submatrices as possible in
-       * parallel. If threads are left, leave them for MKL's internal
-       * parallelism. */
-      mkl_threads = omp_get_max_threads() / submatrices_for_me;
-      if (mkl_threads < 1) {
-        mkl_threads = 1;
+#endif
+      memset(&rec, 0, sizeof(rec));
+      rec.dist = MPI_Wtime() - tDist;
+      trace_event(TRACE_DISTRIBUTE, prop.input, prop.size, 1, tTrace,
+                  trace_clock());
+
+      memset(&stats, 0, sizeof(stats));
+      tTrace = trace_clock();
+      if (prop.filter > 0) {
+        // Solve with the filtered matrix, the full one is back for the
+        // results below
+        filter_matrix(num_cols, col_ptr, row_ind, values, prop.filter, &filt);
+        col_ptr = filt.col_ptr;
+        row_ind = filt.row_ind;
+        values = filt.values;
       }
-      mkl_set_num_threads(mkl_threads);
+      solve_values = values;
 
-      printf("%d: We have %d thread(s) to solve %d submatrices. Give %d "
-             "thread(s) to MKL for each submatrix operation.\n", world_rank,
-             omp_get_max_threads(), submatrices_for_me, mkl_threads);
+      if (prop.min_chunk) {
+        mkl_set_num_threads(1);
+        printf("%d: We have %d thread(s) to solve chunks of submatrices. Give "
+               "1 thread to MKL for each submatrix operation.\n", world_rank,
+               omp_get_max_threads());
 
-      double durationBuild = .0;
-      double durationCalc = .0;
-      tStart = MPI_Wtime();
-      // printf("%d: Starting the number crunching\n", world_rank);
-      #pragma omp parallel for schedule(dynamic) reduction(+:durationBuild,durationCalc)
-      for (i = 0; i < submatrices_for_me; i++) {
-        double locDurBuild, locDurCalc;
-        // printf("%d: Inverting submatrix %d in thread %d.\n", world_rank,
-        //        (world_rank-1)*submatrices_for_me + i, omp_get_thread_num());
-        invert_submatrix(values, row_ind, col_ptr,
-          &(values_inv[
-            col_ptr[my_first_col + i] -
-            col_ptr[my_first_col]
-          ]), my_first_col + i, &locDurBuild, &locDurCalc);
-        durationBuild += locDurBuild;
-        durationCalc += locDurCalc;
+        ws = create_workspaces(omp_get_max_threads(),
+                               max_column_length(col_ptr, 0, prop.size),
+                               &prop.solver);
+        if (prop.filter > 0 && prop.filter_keep) {
+          filter_keep_values(&filt, ws, omp_get_max_threads());
+        }
+        tStart = MPI_Wtime();
+        total_elem = solve_dynamic(values, row_ind, col_ptr, prop.size,
+                                   prop.min_chunk, &prop.solver, ws,
+                                   &values_inv, &chunks, &num_chunks,
+                                   &stats);
+        tEnd = MPI_Wtime();
+        collect_workspaces(ws, omp_get_max_threads(), &stats);
+        free_workspaces(ws, omp_get_max_threads());
+
+        printf("%d: Solved %d columns in %d chunks.\n", world_rank,
+               stats.columns, num_chunks);
+      } else {
+        my_first_col = bounds[world_rank-1];
+        next_first_col = bounds[world_rank];
+        if (prop.distribution != DIST_BCAST) {
+          my_first_col = local.first_col;
+          next_first_col = local.last_col;
+        }
+        submatrices_for_me = next_first_col - my_first_col;
+        total_elem = col_ptr[next_first_col] - col_ptr[my_first_col];
+
+        dirty = NULL;
+        if (prop.tolerance >= 0 && can_update(&prev, num_cols, col_ptr,
+                                              row_ind, my_first_col,
+                                              next_first_col)) {
+          // Same pattern as last time: start from the previous results
+          dirty = (MKL_INT*) malloc(submatrices_for_me * sizeof(MKL_INT));
+          num_dirty = find_dirty_columns(&prev, values, prop.tolerance,
+                                         dirty);
+          printf("%d: Incremental update: %d of %d submatrices changed.\n",
+                 world_rank, num_dirty, submatrices_for_me);
+          submatrices_for_me = num_dirty;
+          solve_values = prev.values;
+          values_inv = prev.values_inv;
+          prev.values_inv = NULL;
+        } else {
+          values_inv = (double*) calloc(total_elem, sizeof(double));
+        }
+
+        /* Optimize threading: We should do as much submatrices as possible in
+         * parallel, one thread each. Only the submatrices too large for that
+         * get all threads in MKL, see solve_large_columns. */
+        mkl_set_num_threads(1);
+
+        printf("%d: We have %d thread(s) to solve %d submatrices.\n",
+               world_rank, omp_get_max_threads(), submatrices_for_me);
+
+        // Scratch memory for every thread, sized for our longest column
+        ws = create_workspaces(omp_get_max_threads(),
+                               max_column_length(col_ptr, my_first_col,
+                                                 next_first_col),
+                               &prop.solver);
+        if (prop.filter > 0 && prop.filter_keep) {
+          filter_keep_values(&filt, ws, omp_get_max_threads());
+        }
+
+        tStart = MPI_Wtime();
+        // printf("%d: Starting the number crunching\n", world_rank);
+        if (dirty) {
+          solve_column_list(solve_values, row_ind, col_ptr, values_inv,
+                            my_first_col, dirty, num_dirty, &prop.solver, ws,
+                            &stats);
+          free(dirty);
+        } else {
+          solve_columns(values, row_ind, col_ptr, values_inv, my_first_col,
+                        next_first_col, &prop.solver, ws, &stats);
+        }
+        tEnd = MPI_Wtime();
+        collect_workspaces(ws, omp_get_max_threads(), &stats);
+        free_workspaces(ws, omp_get_max_threads());
       }
-      tEnd = MPI_Wtime();
 
-      printf("%d: Wall time elapsed: %dms\n", world_rank,
-            (int)((tEnd-tStart)*1000));
-      printf("%d: CPU time sm build: %dms\n", world_rank,
-            (int)(durationBuild*1000));
-      printf("%d: CPU time sm calc: %dms\n", world_rank,
-            (int)(durationCalc*1000));
+      print_solve_stats(world_rank, &prop.solver, &stats, tStart, tEnd);
+      rec.wall = tEnd - tStart;
+      trace_event(TRACE_SOLVE, prop.input, prop.size, 1, tTrace,
+                  trace_clock());
+      if (prop.filter > 0) {
+        // The results get the pattern of the full matrix, 0 where entries
+        // were dropped
+        if (prop.min_chunk) {
+          total_elem = expand_dynamic(&filt, &values_inv, chunks, num_chunks);
+        } else {
+          total_elem = filt.full_col_ptr[next_first_col] -
+                       filt.full_col_ptr[my_first_col];
+          expanded = (double*) malloc((total_elem ? total_elem : 1) *
+                                      sizeof(double));
+          filter_expand(&filt, my_first_col, next_first_col, values_inv,
+                        expanded);
+          free(values_inv);
+          values_inv = expanded;
+        }
+        col_ptr = filt.full_col_ptr;
+        row_ind = filt.full_row_ind;
+        values = filt.full_values;
+        free_filter(&filt);
+      }
 
 
       // printf("%d: Send results to root\n", world_rank);
-      MPI_Gatherv(values_inv, total_elem, MPI_DOUBLE, NULL, NULL, NULL,
-                  MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      tStart = MPI_Wtime();
+      tTrace = trace_clock();
+      if (prop.min_chunk && prop.output == OUTPUT_MPIIO) {
+        write_dynamic(fn_out_val, prop.out_hints, col_ptr, values_inv, chunks,
+                      num_chunks);
+        free(chunks);
+      } else if (prop.min_chunk) {
+        gather_dynamic(col_ptr, values_inv, total_elem, chunks, num_chunks,
+                       NULL);
+        free(chunks);
+      } else if (prop.output == OUTPUT_MPIIO) {
+        // Our columns are contiguous in the result file as well
+        MPI_Scatter(NULL, 1, MPI_INT, &first_elem, 1, MPI_INT, 0,
+                    MPI_COMM_WORLD);
+        offset = first_elem;
+        length = total_elem;
+        if (write_values(fn_out_val, prop.out_hints, 1, &length, &offset,
+                         values_inv, MPI_COMM_WORLD) != 0) {
+          MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        free(bounds);
+      } else {
+        MPI_Gatherv(values_inv, total_elem, MPI_DOUBLE, NULL, NULL, NULL,
+                    MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        free(bounds);
+      }
       // printf("%d: ... done\n", world_rank);
+      trace_event(TRACE_OUTPUT, prop.input, prop.size, 1, tTrace,
+                  trace_clock());
+      rec.gather = MPI_Wtime() - tStart;
+      if (prop.residual != RESIDUAL_NONE) {
+        tTrace = trace_clock();
+        check_residual(&prop, NULL, NULL, NULL, NULL, &res);
+        trace_event(TRACE_RESIDUAL, prop.input, prop.size, 1, tTrace,
+                    trace_clock());
+      }
+      if (prop.records) {
+        fill_record(&rec, world_rank, &stats);
+        bench_gather(&rec, NULL, MPI_COMM_WORLD);
+      }
 
-      memset(values_inv, 0, total_elem * sizeof(double));
-      free(values_inv);
+      if (prop.tolerance >= 0) {
+        // Keep input and results around for the next job
+        remember_job(&prev, num_cols, col_ptr, row_ind, solve_values,
+                     my_first_col, next_first_col, values_inv);
+      } else {
+        memset(values_inv, 0, total_elem * sizeof(double));
+        free(values_inv);
+      }
 #if defined USE_BEEGFS && defined USE_MMAP
-      munmap(values, total_nnz*sizeof(double));
-      munmap(row_ind, total_nnz*sizeof(MKL_INT));
-      munmap(col_ptr, (prop.size+1)*sizeof(MKL_INT));
+      csc_close(&in);
 #else
       memset(values, 0, total_nnz*sizeof(double));
       memset(row_ind, 0, total_nnz*sizeof(MKL_INT));
-      memset(col_ptr, 0, (prop.size+1)*sizeof(MKL_INT));
+      memset(col_ptr, 0, (num_cols+1)*sizeof(MKL_INT));
       free(values);
       free(row_ind);
       free(col_ptr);
+      if (prop.distribution != DIST_BCAST) {
+        free(local.cols);
+      }
 #endif
     }
 
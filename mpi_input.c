@@ -0,0 +1,377 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mkl.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "csc_io.h"
+#include "halo.h"
+#include "mpi_input.h"
+
+#define PATHLEN 255
+
+/* Turn hints of the form key=value[,key=value...] into an MPI_Info, e.g.
+ * romio_cb_read=enable,cb_nodes=4,cb_buffer_size=16777216. Items without a
+ * value, like "default", set nothing. */
+MPI_Info hints_to_info(const char *hints) {
+  char buf[HINTS_LEN], *item, *value, *save;
+  MPI_Info info;
+
+  MPI_Info_create(&info);
+  strncpy(buf, hints, HINTS_LEN-1);
+  buf[HINTS_LEN-1] = '\0';
+  for (item = strtok_r(buf, ",", &save); item != NULL;
+       item = strtok_r(NULL, ",", &save)) {
+    value = strchr(item, '=');
+    if (value != NULL) {
+      *value = '\0';
+      MPI_Info_set(info, item, value+1);
+    }
+  }
+  return info;
+}
+
+/* Check the header of the container and fill in size, nnz and the offsets
+ * of the arrays. Returns 0 if we can read it. */
+static int describe_container(const char *name, struct mpi_input *in,
+                              long long *meta) {
+  struct csc_header h;
+  MPI_Offset length;
+
+  MPI_File_get_size(in->fh[0], &length);
+  if ((size_t)length < sizeof(h) ||
+      MPI_File_read_at(in->fh[0], 0, &h, sizeof(h), MPI_BYTE,
+                       MPI_STATUS_IGNORE) != MPI_SUCCESS ||
+      !csc_header_valid(&h)) {
+    fprintf(stderr, "%s.csc: Not a CSC container of version %d\n", name,
+            CSC_VERSION);
+    return -1;
+  }
+  // Converting would need a second buffer per array, which is what we avoid
+  if (h.index_width != sizeof(MKL_INT) || h.value_type != CSC_DOUBLE) {
+    fprintf(stderr, "%s.csc: MPI-IO input needs %d byte indices and double "
+            "values\n", name, (int)sizeof(MKL_INT));
+    return -1;
+  }
+  if (h.col_ptr_offset + (h.size+1) * h.index_width > (uint64_t)length ||
+      h.row_ind_offset + h.nnz * h.index_width > (uint64_t)length ||
+      h.values_offset + h.nnz * sizeof(double) > (uint64_t)length) {
+    fprintf(stderr, "%s.csc: Corrupt header\n", name);
+    return -1;
+  }
+  meta[1] = h.size;
+  meta[2] = h.nnz;
+  meta[3] = h.col_ptr_offset;
+  meta[4] = h.row_ind_offset;
+  meta[5] = h.values_offset;
+  return 0;
+}
+
+/* The same for the .cp/.ri/.val triple, where the size follows from the
+ * length of <name>.cp and the arrays start at the beginning of the files. */
+static int describe_triple(const char *name, struct mpi_input *in,
+                           long long *meta) {
+  MPI_Offset length[3];
+  MKL_INT nnz;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    MPI_File_get_size(in->fh[i], &(length[i]));
+  }
+  if (length[0] < (MPI_Offset)sizeof(MKL_INT)) {
+    fprintf(stderr, "%s.cp: Empty file\n", name);
+    return -1;
+  }
+  MPI_File_read_at(in->fh[0], length[0] - sizeof(MKL_INT), &nnz, 1, MPI_INT,
+                   MPI_STATUS_IGNORE);
+  if (length[1] < (MPI_Offset)(nnz * sizeof(MKL_INT)) ||
+      length[2] < (MPI_Offset)(nnz * sizeof(double))) {
+    fprintf(stderr, "%s: Files too short for %ld nonzeros\n", name,
+            (long)nnz);
+    return -1;
+  }
+  meta[1] = length[0] / sizeof(MKL_INT) - 1;
+  meta[2] = nnz;
+  meta[3] = meta[4] = meta[5] = 0;
+  return 0;
+}
+
+/* Open the matrix called name on all ranks of comm: the container
+ * <name>.csc if there is one, otherwise the triple files. hints are passed
+ * to MPI_File_open, see hints_to_info. Rank 0 checks the header and tells the
+ * others. Collective, returns 0 on success on all ranks. */
+int mpi_input_open(const char *name, const char *hints, MPI_Comm comm,
+                   struct mpi_input *in) {
+  const char *suffix[3] = {"cp", "ri", "val"};
+  char path[PATHLEN];
+  long long meta[6];
+  MPI_Info info;
+  int rank, i;
+  double t;
+
+  t = MPI_Wtime();
+  memset(in, 0, sizeof(*in));
+  MPI_Comm_rank(comm, &rank);
+  info = hints_to_info(hints);
+
+  snprintf(path, PATHLEN, "%s.csc", name);
+  if (MPI_File_open(comm, path, MPI_MODE_RDONLY, info, &(in->fh[0])) ==
+      MPI_SUCCESS) {
+    in->files = 1;
+    in->fh[1] = in->fh[0];
+    in->fh[2] = in->fh[0];
+  } else {
+    for (i = 0; i < 3; i++) {
+      snprintf(path, PATHLEN, "%s.%s", name, suffix[i]);
+      if (MPI_File_open(comm, path, MPI_MODE_RDONLY, info, &(in->fh[i])) !=
+          MPI_SUCCESS) {
+        if (rank == 0) {
+          fprintf(stderr, "%s: Cannot open file\n", path);
+        }
+        mpi_input_close(in);
+        MPI_Info_free(&info);
+        return -1;
+      }
+      in->files = i+1;
+    }
+  }
+  MPI_Info_free(&info);
+
+  if (rank == 0) {
+    meta[0] = in->files == 1 ? describe_container(name, in, meta) :
+                               describe_triple(name, in, meta);
+  }
+  MPI_Bcast(meta, 6, MPI_LONG_LONG, 0, comm);
+  if (meta[0] != 0) {
+    mpi_input_close(in);
+    return -1;
+  }
+  in->size = meta[1];
+  in->nnz = meta[2];
+  for (i = 0; i < 3; i++) {
+    in->disp[i] = meta[3+i];
+  }
+  in->time[PHASE_OPEN] = MPI_Wtime() - t;
+  return 0;
+}
+
+/* Read count entries of col_ptr from entry first on. Collective, ranks that
+ * need nothing pass count 0. */
+void mpi_input_col_ptr(struct mpi_input *in, MKL_INT first, MKL_INT count,
+                       MKL_INT *col_ptr) {
+  double t = MPI_Wtime();
+
+  MPI_File_read_at_all(in->fh[0], in->disp[0] + first * sizeof(MKL_INT),
+                       col_ptr, count, MPI_INT, MPI_STATUS_IGNORE);
+  in->bytes += count * sizeof(MKL_INT);
+  in->time[PHASE_COL_PTR] += MPI_Wtime() - t;
+}
+
+/* Read all of row_ind on this rank alone. */
+void mpi_input_row_ind(struct mpi_input *in, MKL_INT *row_ind) {
+  MPI_File_read_at(in->fh[1], in->disp[1], row_ind, in->nnz, MPI_INT,
+                   MPI_STATUS_IGNORE);
+  in->bytes += in->nnz * sizeof(MKL_INT);
+}
+
+/* The same for values. */
+void mpi_input_values(struct mpi_input *in, double *values) {
+  MPI_File_read_at(in->fh[2], in->disp[2], values, in->nnz, MPI_DOUBLE,
+                   MPI_STATUS_IGNORE);
+  in->bytes += in->nnz * sizeof(double);
+}
+
+/* Set a view of fh that shows the blocks of lengths[b] elements at
+ * offsets[b] elements behind disp one after the other. That makes them one
+ * request per rank, which MPI-IO can merge with those of the others. Returns
+ * the number of elements in the view. Collective. */
+int set_block_view(MPI_File fh, MPI_Offset disp, MPI_Datatype etype,
+                   int nblocks, int *lengths, MPI_Aint *offsets) {
+  MPI_Datatype filetype;
+  MPI_Aint *bytes;
+  int b, count, width;
+
+  MPI_Type_size(etype, &width);
+  filetype = etype;
+  count = 0;
+  if (nblocks > 0) {
+    bytes = (MPI_Aint*) malloc(nblocks * sizeof(MPI_Aint));
+    for (b = 0; b < nblocks; b++) {
+      bytes[b] = offsets[b] * width;
+      count += lengths[b];
+    }
+    MPI_Type_create_hindexed(nblocks, lengths, bytes, etype, &filetype);
+    MPI_Type_commit(&filetype);
+    free(bytes);
+  }
+  MPI_File_set_view(fh, disp, etype, filetype, "native", MPI_INFO_NULL);
+  if (nblocks > 0) {
+    MPI_Type_free(&filetype);
+  }
+  return count;
+}
+
+/* Read the blocks of set_block_view into buf. Collective. */
+static void read_blocks(MPI_File fh, MPI_Offset disp, MPI_Datatype etype,
+                        int nblocks, int *lengths, MPI_Aint *offsets,
+                        void *buf) {
+  int count;
+
+  count = set_block_view(fh, disp, etype, nblocks, lengths, offsets);
+  MPI_File_read_all(fh, buf, count, etype, MPI_STATUS_IGNORE);
+  MPI_File_set_view(fh, 0, MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL);
+}
+
+/* Read what a worker solving the columns first_col to last_col-1 needs and
+ * build its local matrix, the same one extract_local builds from the whole
+ * matrix. First our own columns, whose rows are the halo, then the halo
+ * columns. Consecutive halo columns are read as one block. Collective, ranks
+ * that need nothing pass first_col == last_col. */
+void mpi_input_local(struct mpi_input *in, MKL_INT first_col,
+                     MKL_INT last_col, struct local_matrix *local) {
+  MKL_INT ncols = last_col - first_col, own_nnz, j, r, nruns, base, total;
+  MKL_INT *own_ptr, *own_rows, *halo_ptr, *col_start, *col_end, *rows;
+  MPI_Aint *offsets;
+  int *lengths;
+  double *values, t;
+
+  t = MPI_Wtime();
+  own_ptr = (MKL_INT*) calloc(ncols+1, sizeof(MKL_INT));
+  MPI_File_read_at_all(in->fh[0], in->disp[0] + first_col * sizeof(MKL_INT),
+                       own_ptr, ncols ? ncols+1 : 0, MPI_INT,
+                       MPI_STATUS_IGNORE);
+  own_nnz = own_ptr[ncols] - own_ptr[0];
+  own_rows = (MKL_INT*) malloc((own_nnz ? own_nnz : 1) * sizeof(MKL_INT));
+  MPI_File_read_at_all(in->fh[1],
+                       in->disp[1] + own_ptr[0] * sizeof(MKL_INT), own_rows,
+                       own_nnz, MPI_INT, MPI_STATUS_IGNORE);
+  for (j = ncols; j >= 0; j--) {
+    own_ptr[j] -= own_ptr[0];
+  }
+  local->size = find_halo(own_ptr, own_rows, 0, ncols, &(local->cols));
+  in->bytes += ((ncols ? ncols+1 : 0) + own_nnz) * sizeof(MKL_INT);
+  free(own_rows);
+  free(own_ptr);
+  in->time[PHASE_OWN] = MPI_Wtime() - t;
+
+  // A run of n consecutive halo columns needs n+1 entries of col_ptr, so
+  // halo column j of run r finds its range at halo_ptr[j+r]
+  t = MPI_Wtime();
+  lengths = (int*) malloc((local->size ? local->size : 1) * sizeof(int));
+  offsets = (MPI_Aint*) malloc((local->size ? local->size : 1) *
+                               sizeof(MPI_Aint));
+  for (j = 0, nruns = 0; j < local->size; j++) {
+    if (j == 0 || local->cols[j] != local->cols[j-1] + 1) {
+      offsets[nruns] = local->cols[j];
+      lengths[nruns] = 1;
+      nruns++;
+    }
+    lengths[nruns-1]++;
+  }
+  halo_ptr = (MKL_INT*) malloc((local->size + nruns + 1) * sizeof(MKL_INT));
+  read_blocks(in->fh[0], in->disp[0], MPI_INT, nruns, lengths, offsets,
+              halo_ptr);
+  in->bytes += (local->size + nruns) * sizeof(MKL_INT);
+  in->time[PHASE_HALO_PTR] = MPI_Wtime() - t;
+
+  // The rows of a run are contiguous as well
+  t = MPI_Wtime();
+  col_start = (MKL_INT*) malloc((local->size ? local->size : 1) *
+                                sizeof(MKL_INT));
+  col_end = (MKL_INT*) malloc((local->size ? local->size : 1) *
+                              sizeof(MKL_INT));
+  for (j = 0, r = -1, base = 0, total = 0; j < local->size; j++) {
+    if (j == 0 || local->cols[j] != local->cols[j-1] + 1) {
+      r++;
+      offsets[r] = halo_ptr[j+r];
+      lengths[r] = 0;
+      base = total - halo_ptr[j+r];
+    }
+    col_start[j] = halo_ptr[j+r] + base;
+    col_end[j] = halo_ptr[j+r+1] + base;
+    lengths[r] += col_end[j] - col_start[j];
+    total += col_end[j] - col_start[j];
+  }
+  rows = (MKL_INT*) malloc((total ? total : 1) * sizeof(MKL_INT));
+  values = (double*) malloc((total ? total : 1) * sizeof(double));
+  read_blocks(in->fh[1], in->disp[1], MPI_INT, nruns, lengths, offsets, rows);
+  read_blocks(in->fh[2], in->disp[2], MPI_DOUBLE, nruns, lengths, offsets,
+              values);
+  in->bytes += total * (sizeof(MKL_INT) + sizeof(double));
+  in->time[PHASE_HALO] = MPI_Wtime() - t;
+
+  t = MPI_Wtime();
+  build_local(local, col_start, col_end, rows, values, first_col, last_col);
+  in->time[PHASE_BUILD] = MPI_Wtime() - t;
+
+  free(values);
+  free(rows);
+  free(col_end);
+  free(col_start);
+  free(halo_ptr);
+  free(offsets);
+  free(lengths);
+}
+
+/* Every worker prints its time per phase, rank 0 the slowest rank per phase
+ * and how much all ranks read compared to the size of the matrix. */
+void mpi_input_report(struct mpi_input *in, MPI_Comm comm) {
+  const char *names[INPUT_PHASES] = {"open", "col_ptr", "own columns",
+                                     "halo col_ptr", "halo", "local matrix"};
+  double max[INPUT_PHASES], *times, bytes, matrix;
+  char line[256];
+  int rank, i, len;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Reduce(in->time, max, INPUT_PHASES, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(&(in->bytes), &bytes, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+  times = rank == 0 ? max : in->time;
+  len = 0;
+  for (i = 0; i < INPUT_PHASES; i++) {
+    len += snprintf(line + len, sizeof(line) - len, "%s %s %dms",
+                    i ? "," : "", names[i], (int)(times[i]*1000));
+  }
+  if (rank == 0) {
+    matrix = (in->size + 1 + in->nnz) * sizeof(MKL_INT) +
+             in->nnz * sizeof(double);
+    printf("%d: MPI-IO read, slowest rank per phase:%s\n", rank, line);
+    printf("%d: MPI-IO read %.2f MB on all ranks, %.2f times the matrix.\n",
+           rank, bytes / 1e6, bytes / matrix);
+  } else {
+    printf("%d: MPI-IO read %.2f MB:%s\n", rank, in->bytes / 1e6, line);
+  }
+}
+
+/* Collective. */
+void mpi_input_close(struct mpi_input *in) {
+  int i;
+
+  for (i = 0; i < in->files; i++) {
+    MPI_File_close(&(in->fh[i]));
+  }
+  in->files = 0;
+}
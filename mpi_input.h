@@ -0,0 +1,47 @@
+#ifndef MPI_INPUT_H
+#define MPI_INPUT_H
+
+#include <mkl.h>
+#include <mpi.h>
+#include "halo.h"
+
+/* Room for the MPI-IO hints in the job properties, see mpi_input_open */
+#define HINTS_LEN 128
+
+/* The steps of reading the input, each timed on its own. */
+enum input_phase {
+  PHASE_OPEN = 0,     // open the files, read and check the header
+  PHASE_COL_PTR,      // col_ptr for the partition, rank 0 only
+  PHASE_OWN,          // col_ptr and rows of our own columns
+  PHASE_HALO_PTR,     // col_ptr entries of the halo columns
+  PHASE_HALO,         // rows and values of the halo columns
+  PHASE_BUILD,        // renumbering them into the local matrix
+  INPUT_PHASES
+};
+
+/* A matrix opened by all ranks for collective reads with MPI-IO. */
+struct mpi_input {
+  MPI_File fh[3];     // col_ptr, row_ind and values
+  MPI_Offset disp[3]; // where each array starts in its file
+  int files;          // 1 for a container, 3 for the .cp/.ri/.val triple
+  MKL_INT size;
+  MKL_INT nnz;
+  double time[INPUT_PHASES];
+  double bytes;       // bytes this rank read
+};
+
+MPI_Info hints_to_info(const char *hints);
+int set_block_view(MPI_File fh, MPI_Offset disp, MPI_Datatype etype,
+                   int nblocks, int *lengths, MPI_Aint *offsets);
+int mpi_input_open(const char *name, const char *hints, MPI_Comm comm,
+                   struct mpi_input *in);
+void mpi_input_col_ptr(struct mpi_input *in, MKL_INT first, MKL_INT count,
+                       MKL_INT *col_ptr);
+void mpi_input_row_ind(struct mpi_input *in, MKL_INT *row_ind);
+void mpi_input_values(struct mpi_input *in, double *values);
+void mpi_input_local(struct mpi_input *in, MKL_INT first_col,
+                     MKL_INT last_col, struct local_matrix *local);
+void mpi_input_report(struct mpi_input *in, MPI_Comm comm);
+void mpi_input_close(struct mpi_input *in);
+
+#endif
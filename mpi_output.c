@@ -0,0 +1,80 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include "mpi_input.h"
+#include "mpi_output.h"
+
+/* Write the results of this rank to path with MPI-IO: the blocks of
+ * lengths[b] values at offsets[b] values into the file, taken one after the
+ * other from values. The file gets exactly as long as the blocks of all
+ * ranks reach, which is the layout of <name>.val for a result with the
+ * pattern of the input. hints are passed to MPI_File_open, see
+ * hints_to_info. Every rank that wrote something prints its time, rank 0
+ * the total. Collective, returns 0 on success. */
+int write_values(const char *path, const char *hints, int nblocks,
+                 int *lengths, MPI_Aint *offsets, double *values,
+                 MPI_Comm comm) {
+  MPI_File fh;
+  MPI_Info info;
+  MPI_Offset end, total;
+  double t, tmax;
+  int rank, count, err;
+
+  t = MPI_Wtime();
+  MPI_Comm_rank(comm, &rank);
+  info = hints_to_info(hints);
+  err = MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, info,
+                      &fh);
+  MPI_Info_free(&info);
+  if (err != MPI_SUCCESS) {
+    if (rank == 0) {
+      fprintf(stderr, "%s: Cannot open file for writing\n", path);
+    }
+    return -1;
+  }
+
+  // Cut off what an older, larger result left behind
+  end = nblocks ? offsets[nblocks-1] + lengths[nblocks-1] : 0;
+  MPI_Allreduce(&end, &total, 1, MPI_OFFSET, MPI_MAX, comm);
+  MPI_File_set_size(fh, total * sizeof(double));
+
+  count = set_block_view(fh, 0, MPI_DOUBLE, nblocks, lengths, offsets);
+  MPI_File_write_all(fh, values, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  t = MPI_Wtime() - t;
+
+  MPI_Reduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  if (count > 0) {
+    printf("%d: MPI-IO wrote %.2f MB in %d block(s) in %dms\n", rank,
+           count * sizeof(double) / 1e6, nblocks, (int)(t*1000));
+  }
+  if (rank == 0) {
+    printf("%d: MPI-IO output to %s: %.2f MB, slowest rank %dms, %.1f MB/s\n",
+           rank, path, total * sizeof(double) / 1e6, (int)(tmax*1000),
+           total * sizeof(double) / 1e6 / tmax);
+  }
+  return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef MPI_OUTPUT_H
+#define MPI_OUTPUT_H
+
+#include <mpi.h>
+
+int write_values(const char *path, const char *hints, int nblocks,
+                 int *lengths, MPI_Aint *offsets, double *values,
+                 MPI_Comm comm);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "partition.h"
+
+/* Estimated cost of one submatrix of dimension dim. Building is O(dim^2 log)
+ * and inversion O(dim^3), so for the matrices we care about the cubic term
+ * dominates everything else. */
+double submatrix_cost(MKL_INT dim) {
+  double n = (double)dim;
+  return n*n*n;
+}
+
+static double range_cost(MKL_INT *col_ptr, MKL_INT first, MKL_INT last) {
+  MKL_INT i;
+  double cost = .0;
+  for (i = first; i < last; i++) {
+    cost += submatrix_cost(col_ptr[i+1] - col_ptr[i]);
+  }
+  return cost;
+}
+
+/* Dimension above which a submatrix of the columns cols[0..ncols-1] (or the
+ * ncols columns from first_col on if cols is NULL) costs more than the share
+ * of one of threads threads. Run on a single thread, such a submatrix is
+ * still busy when the others are done. */
+MKL_INT large_threshold(MKL_INT *col_ptr, MKL_INT first_col,
+                        MKL_INT *cols, MKL_INT ncols, int threads) {
+  MKL_INT c, i, dim, threshold = 0, smallest = 0;
+  double share = .0;
+
+  for (c = 0; c < ncols; c++) {
+    i = cols ? cols[c] : first_col + c;
+    share += submatrix_cost(col_ptr[i+1] - col_ptr[i]) / threads;
+  }
+  for (c = 0; c < ncols; c++) {
+    i = cols ? cols[c] : first_col + c;
+    dim = col_ptr[i+1] - col_ptr[i];
+    if (dim > threshold && submatrix_cost(dim) <= share) {
+      threshold = dim;
+    }
+    if (c == 0 || dim < smallest) {
+      smallest = dim;
+    }
+  }
+  // With fewer columns than threads, even the smallest can be too much
+  if (threshold == 0 && smallest > 1) {
+    threshold = smallest - 1;
+  }
+  if (threshold < LARGE_MIN_DIM) {
+    threshold = LARGE_MIN_DIM;
+  }
+  return threshold;
+}
+
+/* Split the columns 0..size-1 into parts contiguous ranges. Range p covers the
+ * columns bounds[p] to bounds[p+1]-1, so bounds needs parts+1 entries. With
+ * PARTITION_COST each boundary is placed where the prefix sum of the
+ * estimated submatrix costs is closest to the ideal share p/parts. */
+void partition_columns(MKL_INT *col_ptr, MKL_INT size, int parts, int scheme,
+                       MKL_INT *bounds) {
+  MKL_INT i, per_part;
+  double total, target, prefix, cost;
+  int p;
+
+  bounds[0] = 0;
+  bounds[parts] = size;
+
+  if (scheme == PARTITION_COUNT) {
+    per_part = size / parts;
+    for (p = 1; p < parts; p++) {
+      bounds[p] = p*per_part;
+    }
+    return;
+  }
+
+  total = range_cost(col_ptr, 0, size);
+  prefix = .0;
+  i = 0;
+  for (p = 1; p < parts; p++) {
+    target = total * p / parts;
+    while (i < size) {
+      cost = submatrix_cost(col_ptr[i+1] - col_ptr[i]);
+      if (prefix + cost > target) {
+        // Take the column if that brings us closer to the target
+        if (prefix + cost - target < target - prefix) {
+          prefix += cost;
+          i++;
+        }
+        break;
+      }
+      prefix += cost;
+      i++;
+    }
+    bounds[p] = i;
+  }
+}
+
+/* Ratio of the most expensive range to the average one. 1.0 is perfect. */
+double partition_imbalance(MKL_INT *col_ptr, int parts, MKL_INT *bounds) {
+  int p;
+  double cost, max, total;
+
+  max = .0;
+  total = .0;
+  for (p = 0; p < parts; p++) {
+    cost = range_cost(col_ptr, bounds[p], bounds[p+1]);
+    total += cost;
+    if (cost > max) {
+      max = cost;
+    }
+  }
+  if (total == .0) {
+    return 1.0;
+  }
+  return max / (total / parts);
+}
+
+void print_partition(MKL_INT *col_ptr, int parts, MKL_INT *bounds,
+                     int first_rank) {
+  int p;
+  double cost, total;
+
+  total = range_cost(col_ptr, 0, bounds[parts]);
+  for (p = 0; p < parts; p++) {
+    cost = range_cost(col_ptr, bounds[p], bounds[p+1]);
+    printf("0: Worker %d gets columns %d to %d (%d submatrices, %.1f%% of the "
+           "estimated cost).\n", first_rank + p, bounds[p], bounds[p+1]-1,
+           bounds[p+1] - bounds[p], total > .0 ? 100.*cost/total : .0);
+  }
+  printf("0: Estimated load imbalance (max/avg): %.3f\n",
+         partition_imbalance(col_ptr, parts, bounds));
+}
@@ -0,0 +1,25 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <mkl.h>
+
+/* How columns are split into contiguous ranges, one range per worker. */
+enum partition_scheme {
+  PARTITION_COUNT = 0, // equal number of columns, remainder to the last worker
+  PARTITION_COST  = 1  // equal estimated cost of the submatrices
+};
+
+/* Below this dimension a team of MKL threads costs more than it saves, so
+ * large_threshold never picks a smaller one. */
+#define LARGE_MIN_DIM 64
+
+double submatrix_cost(MKL_INT dim);
+void partition_columns(MKL_INT *col_ptr, MKL_INT size, int parts, int scheme,
+                       MKL_INT *bounds);
+MKL_INT large_threshold(MKL_INT *col_ptr, MKL_INT first_col,
+                        MKL_INT *cols, MKL_INT ncols, int threads);
+double partition_imbalance(MKL_INT *col_ptr, int parts, MKL_INT *bounds);
+void print_partition(MKL_INT *col_ptr, int parts, MKL_INT *bounds,
+                     int first_rank);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mkl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "halo.h"
+#include "partition.h"
+#include "reorder.h"
+
+/* Append the unvisited neighbours of v to queue[*tail..], by increasing
+ * degree, and mark them with mark. Nodes already placed (mark 1) are left
+ * alone, with a non-symmetric pattern a search can reach them again. */
+static void visit_neighbours(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT v,
+                             MKL_INT *marks, MKL_INT mark, MKL_INT *queue,
+                             MKL_INT *tail) {
+  MKL_INT p, k, u, first = *tail;
+
+  for (p = col_ptr[v]; p < col_ptr[v+1]; p++) {
+    u = row_ind[p];
+    if (marks[u] == mark || marks[u] == 1) {
+      continue;
+    }
+    marks[u] = mark;
+    // Insertion sort by degree, the neighbours of one node are few
+    for (k = (*tail)++; k > first &&
+         col_ptr[queue[k-1]+1] - col_ptr[queue[k-1]] >
+         col_ptr[u+1] - col_ptr[u]; k--) {
+      queue[k] = queue[k-1];
+    }
+    queue[k] = u;
+  }
+}
+
+/* Breadth-first search from start over the nodes not yet placed. Returns the
+ * number of levels and the node of least degree in the last one in *last. */
+static MKL_INT bfs_depth(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT start,
+                         MKL_INT *marks, MKL_INT mark, MKL_INT *queue,
+                         MKL_INT *last) {
+  MKL_INT head = 0, tail = 1, level_start = 0, level_end = 1, depth = 1, v,
+          k;
+
+  queue[0] = start;
+  marks[start] = mark;
+  while (head < tail) {
+    v = queue[head++];
+    visit_neighbours(col_ptr, row_ind, v, marks, mark, queue, &tail);
+    if (head == level_end && tail > level_end) {
+      level_start = level_end;
+      level_end = tail;
+      depth++;
+    }
+  }
+
+  // Only the neighbours of each node are sorted, not the whole level
+  *last = queue[level_start];
+  for (k = level_start+1; k < tail; k++) {
+    if (col_ptr[queue[k]+1] - col_ptr[queue[k]] <
+        col_ptr[*last+1] - col_ptr[*last]) {
+      *last = queue[k];
+    }
+  }
+  return depth;
+}
+
+/* Reverse Cuthill-McKee. Each connected component starts from a
+ * pseudo-peripheral node, found by searching again from the far end of the
+ * previous search for as long as that gets deeper. */
+void rcm_permutation(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT size,
+                     MKL_INT *perm) {
+  MKL_INT *marks, *queue, i, v, start, far, depth, next_depth, mark, head,
+          tail, tmp;
+
+  marks = (MKL_INT*) calloc(size, sizeof(MKL_INT));
+  queue = (MKL_INT*) malloc(size * sizeof(MKL_INT));
+  mark = 1; // 1 means placed, searches use the marks above
+  tail = 0;
+  for (i = 0; i < size; i++) {
+    if (marks[i] == 1) {
+      continue;
+    }
+    start = i;
+    depth = bfs_depth(col_ptr, row_ind, start, marks, ++mark, queue, &far);
+    while (1) {
+      next_depth = bfs_depth(col_ptr, row_ind, far, marks, ++mark, queue, &v);
+      if (next_depth <= depth) {
+        break;
+      }
+      start = far;
+      far = v;
+      depth = next_depth;
+    }
+
+    // The searches marked the component with their own values, so placing
+    // it with mark 1 reaches all of it again
+    head = tail;
+    perm[tail++] = start;
+    marks[start] = 1;
+    while (head < tail) {
+      visit_neighbours(col_ptr, row_ind, perm[head++], marks, 1, perm, &tail);
+    }
+  }
+
+  for (i = 0; i < size/2; i++) {
+    tmp = perm[i];
+    perm[i] = perm[size-1-i];
+    perm[size-1-i] = tmp;
+  }
+  free(queue);
+  free(marks);
+}
+
+struct entry {
+  MKL_INT row;
+  MKL_INT pos;
+};
+
+static int compare_entry(const void *a, const void *b) {
+  MKL_INT x = ((const struct entry*)a)->row, y = ((const struct entry*)b)->row;
+  return (x > y) - (x < y);
+}
+
+/* Reorder the matrix with perm into the new_* arrays, which have the same
+ * sizes as the original ones. map[p] receives the position of original
+ * nonzero p in the reordered matrix, so results computed for that one can be
+ * put back in the original order with unpermute_values. */
+void permute_matrix(MKL_INT *col_ptr, MKL_INT *row_ind, double *values,
+                    MKL_INT size, MKL_INT *perm, MKL_INT *new_col_ptr,
+                    MKL_INT *new_row_ind, double *new_values, MKL_INT *map) {
+  MKL_INT i, k, p, len, max_len = 0, *iperm;
+  struct entry *column;
+
+  iperm = (MKL_INT*) malloc(size * sizeof(MKL_INT));
+  new_col_ptr[0] = 0;
+  for (k = 0; k < size; k++) {
+    iperm[perm[k]] = k;
+    len = col_ptr[perm[k]+1] - col_ptr[perm[k]];
+    new_col_ptr[k+1] = new_col_ptr[k] + len;
+    if (len > max_len) {
+      max_len = len;
+    }
+  }
+
+  column = (struct entry*) malloc((max_len ? max_len : 1) *
+                                  sizeof(struct entry));
+  for (k = 0; k < size; k++) {
+    i = perm[k];
+    len = col_ptr[i+1] - col_ptr[i];
+    for (p = 0; p < len; p++) {
+      column[p].row = iperm[row_ind[col_ptr[i] + p]];
+      column[p].pos = col_ptr[i] + p;
+    }
+    qsort(column, len, sizeof(struct entry), compare_entry);
+    for (p = 0; p < len; p++) {
+      new_row_ind[new_col_ptr[k] + p] = column[p].row;
+      new_values[new_col_ptr[k] + p] = values[column[p].pos];
+      map[column[p].pos] = new_col_ptr[k] + p;
+    }
+  }
+  free(column);
+  free(iperm);
+}
+
+void unpermute_values(double *new_values, MKL_INT nnz, MKL_INT *map,
+                      double *values) {
+  MKL_INT p;
+  #pragma omp parallel for
+  for (p = 0; p < nnz; p++) {
+    values[p] = new_values[map[p]];
+  }
+}
+
+MKL_INT matrix_bandwidth(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT size) {
+  MKL_INT i, p, bandwidth = 0;
+  for (i = 0; i < size; i++) {
+    for (p = col_ptr[i]; p < col_ptr[i+1]; p++) {
+      if (abs(row_ind[p] - i) > bandwidth) {
+        bandwidth = abs(row_ind[p] - i);
+      }
+    }
+  }
+  return bandwidth;
+}
+
+/* Sum and maximum of the halo sizes (in columns) the workers would get when
+ * the matrix is split into parts ranges with scheme. */
+static void halo_volume(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT size,
+                        int parts, int scheme, MKL_INT *sum, MKL_INT *max) {
+  MKL_INT *bounds, *cols, num;
+  int p;
+
+  bounds = (MKL_INT*) calloc(parts+1, sizeof(MKL_INT));
+  partition_columns(col_ptr, size, parts, scheme, bounds);
+  *sum = 0;
+  *max = 0;
+  for (p = 0; p < parts; p++) {
+    num = find_halo(col_ptr, row_ind, bounds[p], bounds[p+1], &cols);
+    *sum += num;
+    if (num > *max) {
+      *max = num;
+    }
+    free(cols);
+  }
+  free(bounds);
+}
+
+void print_reordering(MKL_INT *col_ptr, MKL_INT *row_ind,
+                      MKL_INT *new_col_ptr, MKL_INT *new_row_ind,
+                      MKL_INT size, int parts, int scheme) {
+  MKL_INT sum, max, new_sum, new_max;
+
+  printf("0: Reordering changes the bandwidth from %d to %d.\n",
+         matrix_bandwidth(col_ptr, row_ind, size),
+         matrix_bandwidth(new_col_ptr, new_row_ind, size));
+  halo_volume(col_ptr, row_ind, size, parts, scheme, &sum, &max);
+  halo_volume(new_col_ptr, new_row_ind, size, parts, scheme, &new_sum,
+              &new_max);
+  printf("0: Estimated halo per rank: %.1f columns on average (max %d) "
+         "before, %.1f (max %d) after reordering.\n", (double)sum / parts, max,
+         (double)new_sum / parts, new_max);
+}
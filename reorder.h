@@ -0,0 +1,26 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <mkl.h>
+
+enum reordering {
+  REORDER_NONE = 0,
+  REORDER_RCM  = 1  // reverse Cuthill-McKee, reduces the bandwidth
+};
+
+/* Symmetric reordering of the input before it is distributed. Column k of
+ * the reordered matrix is column perm[k] of the original one, with its rows
+ * renumbered the same way. */
+void rcm_permutation(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT size,
+                     MKL_INT *perm);
+void permute_matrix(MKL_INT *col_ptr, MKL_INT *row_ind, double *values,
+                    MKL_INT size, MKL_INT *perm, MKL_INT *new_col_ptr,
+                    MKL_INT *new_row_ind, double *new_values, MKL_INT *map);
+void unpermute_values(double *new_values, MKL_INT nnz, MKL_INT *map,
+                      double *values);
+MKL_INT matrix_bandwidth(MKL_INT *col_ptr, MKL_INT *row_ind, MKL_INT size);
+void print_reordering(MKL_INT *col_ptr, MKL_INT *row_ind,
+                      MKL_INT *new_col_ptr, MKL_INT *new_row_ind,
+                      MKL_INT size, int parts, int scheme);
+
+#endif
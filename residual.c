@@ -0,0 +1,305 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <mkl.h>
+#include <mpi.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "residual.h"
+
+/* Same seed on every rank, so all of them draw the same samples */
+#define RESIDUAL_SEED 0x5eed
+
+/* A matrix in CSC and its transpose, which is its CSR */
+struct csc {
+  MKL_INT size;
+  MKL_INT *col_ptr;
+  MKL_INT *row_ind;
+  double *values;
+};
+
+/* splitmix64, see generate-matrix */
+static uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static void transpose(struct csc *m, struct csc *t) {
+  MKL_INT i, k, *next, nnz = m->col_ptr[m->size];
+
+  t->size = m->size;
+  t->col_ptr = (MKL_INT*) calloc(m->size + 1, sizeof(MKL_INT));
+  t->row_ind = (MKL_INT*) malloc((nnz ? nnz : 1) * sizeof(MKL_INT));
+  t->values = (double*) malloc((nnz ? nnz : 1) * sizeof(double));
+  for (k = 0; k < nnz; k++) {
+    t->col_ptr[m->row_ind[k] + 1]++;
+  }
+  for (i = 0; i < m->size; i++) {
+    t->col_ptr[i+1] += t->col_ptr[i];
+  }
+  next = (MKL_INT*) malloc((m->size ? m->size : 1) * sizeof(MKL_INT));
+  memcpy(next, t->col_ptr, m->size * sizeof(MKL_INT));
+  for (i = 0; i < m->size; i++) {
+    for (k = m->col_ptr[i]; k < m->col_ptr[i+1]; k++) {
+      t->row_ind[next[m->row_ind[k]]] = i;
+      t->values[next[m->row_ind[k]]++] = m->values[k];
+    }
+  }
+  free(next);
+}
+
+static void free_csc(struct csc *m) {
+  free(m->col_ptr);
+  free(m->row_ind);
+  free(m->values);
+}
+
+/* y = M^T x for the columns of M in bounds[rank] to bounds[rank+1]-1, the
+ * rest of y comes from the other ranks. With the transpose of M in t this
+ * is y = M x. */
+static void gather_product(struct csc *t, double *x, double *y, int *bounds,
+                           int *counts, int rank, MPI_Comm comm) {
+  MKL_INT j;
+
+  #pragma omp parallel for schedule(static)
+  for (j = bounds[rank]; j < bounds[rank+1]; j++) {
+    MKL_INT k;
+    double sum = .0;
+    for (k = t->col_ptr[j]; k < t->col_ptr[j+1]; k++) {
+      sum += t->values[k] * x[t->row_ind[k]];
+    }
+    y[j] = sum;
+  }
+  MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DOUBLE, y, counts, bounds, MPI_DOUBLE,
+                 comm);
+}
+
+/* y = R x = X^p A x - x, or R^T x = A^T (X^T)^p x - x with transposed set.
+ * at and xt are the transposes of A and X, tmp has room for two vectors. */
+static void apply_residual(struct csc *a, struct csc *at, struct csc *x,
+                           struct csc *xt, int p, int transposed,
+                           double *in, double *out, double *tmp, int *bounds,
+                           int *counts, int rank, MPI_Comm comm) {
+  double *u = tmp, *v = tmp + a->size, *s;
+  MKL_INT i;
+  int k;
+
+  if (!transposed) {
+    gather_product(at, in, u, bounds, counts, rank, comm);
+    for (k = 0; k < p; k++) {
+      gather_product(xt, u, v, bounds, counts, rank, comm);
+      s = u;
+      u = v;
+      v = s;
+    }
+  } else {
+    memcpy(u, in, a->size * sizeof(double));
+    for (k = 0; k < p; k++) {
+      gather_product(x, u, v, bounds, counts, rank, comm);
+      s = u;
+      u = v;
+      v = s;
+    }
+    gather_product(a, u, v, bounds, counts, rank, comm);
+    u = v;
+  }
+  for (i = 0; i < a->size; i++) {
+    out[i] = u[i] - in[i];
+  }
+}
+
+static double norm2(MKL_INT n, double *x) {
+  double sum = .0;
+  MKL_INT i;
+  for (i = 0; i < n; i++) {
+    sum += x[i] * x[i];
+  }
+  return sqrt(sum);
+}
+
+/* y = M x for a sparse x with nx entries at idx, into the dense y, which is
+ * zero where mark is zero. The entries of y are listed in out_idx, their
+ * number returned. */
+static MKL_INT sparse_product(struct csc *m, MKL_INT *idx, double *x,
+                              MKL_INT nx, double *y, char *mark,
+                              MKL_INT *out_idx) {
+  MKL_INT c, k, r, ny = 0;
+  for (c = 0; c < nx; c++) {
+    for (k = m->col_ptr[idx[c]]; k < m->col_ptr[idx[c]+1]; k++) {
+      r = m->row_ind[k];
+      if (!mark[r]) {
+        mark[r] = 1;
+        y[r] = .0;
+        out_idx[ny++] = r;
+      }
+      y[r] += m->values[k] * x[c];
+    }
+  }
+  return ny;
+}
+
+/* ||R e_j||^2 for column j, exactly. Each product with X only touches the
+ * rows reachable from the pattern of column j of A. */
+static double column_residual(struct csc *a, struct csc *x, int p, MKL_INT j,
+                              double *y, char *mark, MKL_INT *idx,
+                              MKL_INT *idx2, double *vals) {
+  MKL_INT c, n, *s;
+  double sum = .0, d;
+  int k;
+
+  n = a->col_ptr[j+1] - a->col_ptr[j];
+  memcpy(idx, &(a->row_ind[a->col_ptr[j]]), n * sizeof(MKL_INT));
+  memcpy(vals, &(a->values[a->col_ptr[j]]), n * sizeof(double));
+  for (k = 0; k < p; k++) {
+    n = sparse_product(x, idx, vals, n, y, mark, idx2);
+    for (c = 0; c < n; c++) {
+      vals[c] = y[idx2[c]];
+      mark[idx2[c]] = 0;
+    }
+    s = idx;
+    idx = idx2;
+    idx2 = s;
+  }
+  for (c = 0; c < n; c++) {
+    d = vals[c] - (idx[c] == j);
+    sum += d * d;
+    if (idx[c] == j) {
+      j = -1; // the diagonal is in the pattern
+    }
+  }
+  return j < 0 ? sum : sum + 1.;
+}
+
+/* Estimate the residual R = X^p A - I of the approximate inverse p-th root
+ * X, which has the pattern of A, without forming it. All ranks in comm take
+ * part with the whole matrices and share the work.
+ *
+ * RESIDUAL_COLUMNS computes ||R e_j|| exactly for samples random columns,
+ * only touching the rows the patterns reach. n/samples times the sum of
+ * their squares estimates ||R||_F^2, the largest one bounds ||R||_2 from
+ * below. RESIDUAL_PROBE uses samples random +-1 vectors z instead: the mean
+ * of ||R z||^2 estimates ||R||_F^2, and as many power iterations on R^T R
+ * estimate ||R||_2. */
+void estimate_residual(MKL_INT size, MKL_INT *col_ptr, MKL_INT *row_ind,
+                       double *values, double *values_inv, int p, int method,
+                       int samples, MPI_Comm comm, struct residual *res) {
+  struct csc a = {size, col_ptr, row_ind, values};
+  struct csc x = {size, col_ptr, row_ind, values_inv};
+  struct csc at, xt;
+  int rank, ranks, r, s, *bounds, *counts;
+  double sum = .0, max = .0, tStart = MPI_Wtime(), *z, *y, *tmp, norm;
+  MKL_INT i;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &ranks);
+  memset(res, 0, sizeof(*res));
+  if (samples < 1 || size < 1) {
+    return;
+  }
+
+  if (method == RESIDUAL_COLUMNS) {
+    // Samples rank, rank+ranks, ... are ours
+    #pragma omp parallel reduction(+:sum) reduction(max:max)
+    {
+      double *y = (double*) malloc(size * sizeof(double));
+      double *vals = (double*) malloc(size * sizeof(double));
+      char *mark = (char*) calloc(size, sizeof(char));
+      MKL_INT *idx = (MKL_INT*) malloc(size * sizeof(MKL_INT));
+      MKL_INT *idx2 = (MKL_INT*) malloc(size * sizeof(MKL_INT));
+      double col;
+      int s;
+      #pragma omp for schedule(dynamic)
+      for (s = rank; s < samples; s += ranks) {
+        col = column_residual(&a, &x, p, mix(RESIDUAL_SEED + s) % size, y,
+                              mark, idx, idx2, vals);
+        sum += col;
+        max = col > max ? col : max;
+      }
+      free(idx2);
+      free(idx);
+      free(mark);
+      free(vals);
+      free(y);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &max, 1, MPI_DOUBLE, MPI_MAX, comm);
+    res->frobenius = sqrt(sum * size / samples);
+    res->spectral = sqrt(max);
+    res->time = MPI_Wtime() - tStart;
+    return;
+  }
+
+  // Products with whole vectors, every rank computes its block of rows
+  bounds = (int*) malloc((ranks + 1) * sizeof(int));
+  counts = (int*) malloc(ranks * sizeof(int));
+  for (r = 0; r <= ranks; r++) {
+    bounds[r] = (MKL_INT)((double)size * r / ranks);
+  }
+  for (r = 0; r < ranks; r++) {
+    counts[r] = bounds[r+1] - bounds[r];
+  }
+  transpose(&a, &at);
+  transpose(&x, &xt);
+  z = (double*) malloc(size * sizeof(double));
+  y = (double*) malloc(size * sizeof(double));
+  tmp = (double*) malloc(2 * size * sizeof(double));
+
+  for (s = 0; s < samples; s++) {
+    for (i = 0; i < size; i++) {
+      z[i] = mix(RESIDUAL_SEED + mix(s) + i) & 1 ? 1. : -1.;
+    }
+    apply_residual(&a, &at, &x, &xt, p, 0, z, y, tmp, bounds, counts, rank,
+                   comm);
+    norm = norm2(size, y);
+    sum += norm * norm;
+  }
+  res->frobenius = sqrt(sum / samples);
+
+  // Power iteration on R^T R, starting from the last probe
+  for (s = 0; s < samples; s++) {
+    norm = norm2(size, z);
+    for (i = 0; i < size; i++) {
+      z[i] /= norm;
+    }
+    apply_residual(&a, &at, &x, &xt, p, 0, z, y, tmp, bounds, counts, rank,
+                   comm);
+    res->spectral = norm2(size, y);
+    apply_residual(&a, &at, &x, &xt, p, 1, y, z, tmp, bounds, counts, rank,
+                   comm);
+  }
+
+  free(tmp);
+  free(y);
+  free(z);
+  free_csc(&xt);
+  free_csc(&at);
+  free(counts);
+  free(bounds);
+  res->time = MPI_Wtime() - tStart;
+}
@@ -0,0 +1,25 @@
+#ifndef RESIDUAL_H
+#define RESIDUAL_H
+
+#include <mkl.h>
+#include <mpi.h>
+
+/* How the residual X^p A - I of an approximate inverse p-th root X is
+ * estimated, see estimate_residual. */
+enum residual_method {
+  RESIDUAL_NONE    = 0,
+  RESIDUAL_COLUMNS = 1, // exact residual of randomly sampled columns
+  RESIDUAL_PROBE   = 2  // products with random +-1 vectors
+};
+
+struct residual {
+  double frobenius; // estimate of ||X^p A - I||_F
+  double spectral;  // estimate of ||X^p A - I||_2, a lower bound
+  double time;
+};
+
+void estimate_residual(MKL_INT size, MKL_INT *col_ptr, MKL_INT *row_ind,
+                       double *values, double *values_inv, int p, int method,
+                       int samples, MPI_Comm comm, struct residual *res);
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mkl.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "batch.h"
+#include "group.h"
+#include "partition.h"
+#include "solve.h"
+#include "submatrix.h"
+#include "workspace.h"
+
+static int is_large(MKL_INT dim, struct solver_options *opts) {
+  return opts->large_dim > 0 && dim > opts->large_dim;
+}
+
+/* Copy opts to resolved and replace an automatic large_dim by the threshold
+ * for the columns cols[0..ncols-1] (or the ncols columns from first_col on if
+ * cols is NULL). The threshold is recorded in stats. */
+struct solver_options *resolve_large_dim(struct solver_options *opts,
+                                         struct solver_options *resolved,
+                                         MKL_INT *col_ptr, MKL_INT first_col,
+                                         MKL_INT *cols, MKL_INT ncols,
+                                         struct solve_stats *stats) {
+  *resolved = *opts;
+  if (resolved->large_dim < 0) {
+    resolved->large_dim = large_threshold(col_ptr, first_col, cols, ncols,
+                                          omp_get_max_threads());
+  }
+  if (resolved->large_dim > 0) {
+    if (stats->large_dim_min == 0 ||
+        resolved->large_dim < stats->large_dim_min) {
+      stats->large_dim_min = resolved->large_dim;
+    }
+    if (resolved->large_dim > stats->large_dim_max) {
+      stats->large_dim_max = resolved->large_dim;
+    }
+  }
+  return resolved;
+}
+
+/* First tier of the scheduler: solve the large submatrices among the columns
+ * cols[0..ncols-1] (or the ncols columns from first_col on if cols is NULL)
+ * one after the other, each with a team of all threads inside MKL. Left to
+ * the parallel loop, a few of them would run on one thread each at the very
+ * end and dominate the runtime. Returns how many were solved. */
+MKL_INT solve_large_columns(double *values, MKL_INT *row_ind,
+                            MKL_INT *col_ptr, double *values_inv,
+                            MKL_INT first_col, MKL_INT *cols, MKL_INT ncols,
+                            struct solver_options *opts, struct workspace *ws,
+                            double *build, double *calc) {
+  MKL_INT c, i, num = 0;
+  int prev_threads;
+  double locDurBuild, locDurCalc;
+
+  if (opts->large_dim <= 0) {
+    return 0;
+  }
+  prev_threads = mkl_set_num_threads_local(omp_get_max_threads());
+  for (c = 0; c < ncols; c++) {
+    i = cols ? cols[c] : first_col + c;
+    if (is_large(col_ptr[i+1] - col_ptr[i], opts)) {
+      invert_submatrix(values, row_ind, col_ptr,
+        &(values_inv[col_ptr[i] - col_ptr[first_col]]), i, opts, ws,
+        &locDurBuild, &locDurCalc);
+      *build += locDurBuild;
+      *calc += locDurCalc;
+      num++;
+    }
+  }
+  mkl_set_num_threads_local(prev_threads);
+  return num;
+}
+
+/* Solve the submatrices for the columns first_col to last_col-1. The result
+ * columns are stored back to back in values_inv, starting with first_col.
+ * With grouping enabled, columns that can share a submatrix are found first
+ * and each group is solved at once. With batching enabled, small submatrices
+ * of equal dimension are solved side by side by the batched kernels, which
+ * only factor in double.
+ * Submatrices above opts->large_dim are solved first with all threads in MKL,
+ * the rest with one thread each. Each thread takes its scratch memory from
+ * its own entry of ws. */
+void solve_columns(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                   double *values_inv, MKL_INT first_col, MKL_INT last_col,
+                   struct solver_options *opts, struct workspace *ws,
+                   struct solve_stats *stats) {
+  MKL_INT i, g, t, num_batches, num_single, *cols, *batch_ptr;
+  MKL_INT large = 0;
+  int prev_threads;
+  struct column_groups groups;
+  struct solver_options resolved;
+  double build = .0;
+  double calc = .0;
+  double cost_columns = .0;
+  double cost_submatrices = .0;
+
+  for (i = first_col; i < last_col; i++) {
+    cost_columns += submatrix_cost(col_ptr[i+1] - col_ptr[i]);
+  }
+  opts = resolve_large_dim(opts, &resolved, col_ptr, first_col, NULL,
+                           last_col - first_col, stats);
+
+  if (!opts->group && opts->batch_max_dim > 0 &&
+      opts->precision == PRECISION_DOUBLE &&
+      (opts->method == SOLVER_LU || opts->method == SOLVER_CHOLESKY)) {
+    cols = (MKL_INT*) malloc((last_col - first_col) * sizeof(MKL_INT));
+    batch_ptr = (MKL_INT*) malloc((last_col - first_col + 1) *
+                                  sizeof(MKL_INT));
+    num_batches = bucket_columns(col_ptr, first_col, last_col,
+                                 opts->batch_max_dim, cols, batch_ptr);
+    num_single = last_col - first_col - batch_ptr[num_batches];
+    stats->large += solve_large_columns(values, row_ind, col_ptr, values_inv,
+                                        first_col,
+                                        &(cols[batch_ptr[num_batches]]),
+                                        num_single, opts, ws, &build, &calc);
+
+    // The large submatrices come first, so they do not end up in the tail
+    #pragma omp parallel for schedule(dynamic) reduction(+:build,calc)
+    for (t = 0; t < num_single + num_batches; t++) {
+      double locDurBuild = .0, locDurCalc = .0, *out[BATCH_LANES];
+      MKL_INT c, first, ncols;
+      if (t < num_single) {
+        MKL_INT i = cols[batch_ptr[num_batches] + t];
+        if (is_large(col_ptr[i+1] - col_ptr[i], opts)) {
+          continue;
+        }
+        invert_submatrix(values, row_ind, col_ptr,
+          &(values_inv[col_ptr[i] - col_ptr[first_col]]), i, opts,
+          &(ws[omp_get_thread_num()]), &locDurBuild, &locDurCalc);
+      } else {
+        first = batch_ptr[t - num_single];
+        ncols = batch_ptr[t - num_single + 1] - first;
+        for (c = 0; c < ncols; c++) {
+          out[c] = &(values_inv[col_ptr[cols[first+c]] - col_ptr[first_col]]);
+        }
+        solve_batch(values, row_ind, col_ptr, &(cols[first]), ncols, out,
+                    opts, &(ws[omp_get_thread_num()]), &locDurBuild,
+                    &locDurCalc);
+      }
+      build += locDurBuild;
+      calc += locDurCalc;
+    }
+    stats->submatrices += last_col - first_col;
+    stats->batched += batch_ptr[num_batches];
+    stats->batches += num_batches;
+    cost_submatrices = cost_columns;
+    free(batch_ptr);
+    free(cols);
+  } else if (!opts->group) {
+    stats->large += solve_large_columns(values, row_ind, col_ptr, values_inv,
+                                        first_col, NULL, last_col - first_col,
+                                        opts, ws, &build, &calc);
+
+    #pragma omp parallel for schedule(dynamic) reduction(+:build,calc)
+    for (i = first_col; i < last_col; i++) {
+      double locDurBuild, locDurCalc;
+      if (is_large(col_ptr[i+1] - col_ptr[i], opts)) {
+        continue;
+      }
+      // printf("Inverting submatrix %d in thread %d.\n", i,
+      //        omp_get_thread_num());
+      invert_submatrix(values, row_ind, col_ptr,
+        &(values_inv[col_ptr[i] - col_ptr[first_col]]), i, opts,
+        &(ws[omp_get_thread_num()]), &locDurBuild, &locDurCalc);
+      build += locDurBuild;
+      calc += locDurCalc;
+    }
+    stats->submatrices += last_col - first_col;
+    cost_submatrices = cost_columns;
+  } else {
+    group_columns(row_ind, col_ptr, first_col, last_col, opts->group_growth,
+                  &groups);
+
+    // Two passes over the groups: the large ones one after the other with
+    // all threads in MKL first, then the others in parallel
+    for (t = 0; t < 2; t++) {
+      if (t == 0) {
+        if (opts->large_dim <= 0) {
+          continue;
+        }
+        prev_threads = mkl_set_num_threads_local(omp_get_max_threads());
+      }
+      #pragma omp parallel for schedule(dynamic) if(t) \
+                               reduction(+:build,calc,cost_submatrices,large)
+      for (g = 0; g < groups.num_groups; g++) {
+        double locDurBuild, locDurCalc, **out;
+        MKL_INT m, dim, ncols, *cols;
+
+        dim = groups.pattern_ptr[g+1] - groups.pattern_ptr[g];
+        if (is_large(dim, opts) != (t == 0)) {
+          continue;
+        }
+        ncols = groups.member_ptr[g+1] - groups.member_ptr[g];
+        cols = &(groups.members[groups.member_ptr[g]]);
+        out = (double**) malloc(ncols * sizeof(double*));
+        for (m = 0; m < ncols; m++) {
+          out[m] = &(values_inv[col_ptr[cols[m]] - col_ptr[first_col]]);
+        }
+        solve_submatrix(values, row_ind, col_ptr,
+                        &(groups.patterns[groups.pattern_ptr[g]]), dim, cols,
+                        ncols, out, opts, &(ws[omp_get_thread_num()]),
+                        &locDurBuild, &locDurCalc);
+        free(out);
+        build += locDurBuild;
+        calc += locDurCalc;
+        cost_submatrices += submatrix_cost(dim);
+        large += (t == 0);
+      }
+      if (t == 0) {
+        mkl_set_num_threads_local(prev_threads);
+      }
+    }
+    stats->large += large;
+    stats->submatrices += groups.num_groups;
+    free_column_groups(&groups);
+  }
+
+  stats->build += build;
+  stats->calc += calc;
+  stats->columns += last_col - first_col;
+  stats->cost_columns += cost_columns;
+  stats->cost_submatrices += cost_submatrices;
+}
+
+/* Like solve_columns, but only for the columns cols[0..ncols-1] out of the
+ * range starting at first_col. Results of the other columns in values_inv are
+ * left as they are. Every column is solved from its own pattern, there is no
+ * grouping. */
+void solve_column_list(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                       double *values_inv, MKL_INT first_col, MKL_INT *cols,
+                       MKL_INT ncols, struct solver_options *opts,
+                       struct workspace *ws, struct solve_stats *stats) {
+  MKL_INT c;
+  double build = .0;
+  double calc = .0;
+  double cost = .0;
+  struct solver_options resolved;
+
+  opts = resolve_large_dim(opts, &resolved, col_ptr, first_col, cols, ncols,
+                           stats);
+  stats->large += solve_large_columns(values, row_ind, col_ptr, values_inv,
+                                      first_col, cols, ncols, opts, ws, &build,
+                                      &calc);
+
+  #pragma omp parallel for schedule(dynamic) reduction(+:build,calc,cost)
+  for (c = 0; c < ncols; c++) {
+    double locDurBuild, locDurCalc;
+    MKL_INT i = cols[c];
+    cost += submatrix_cost(col_ptr[i+1] - col_ptr[i]);
+    if (is_large(col_ptr[i+1] - col_ptr[i], opts)) {
+      continue;
+    }
+    invert_submatrix(values, row_ind, col_ptr,
+      &(values_inv[col_ptr[i] - col_ptr[first_col]]), i, opts,
+      &(ws[omp_get_thread_num()]), &locDurBuild, &locDurCalc);
+    build += locDurBuild;
+    calc += locDurCalc;
+  }
+
+  stats->build += build;
+  stats->calc += calc;
+  stats->columns += ncols;
+  stats->submatrices += ncols;
+  stats->cost_columns += cost;
+  stats->cost_submatrices += cost;
+}
+
+/* Add up what the threads counted in their workspaces: the refinement
+ * done by refine_unit_columns and the submatrices they solved. */
+void collect_workspaces(struct workspace *ws, int num,
+                        struct solve_stats *stats) {
+  int t, b;
+  for (t = 0; t < num; t++) {
+    stats->refined += ws[t].refined;
+    stats->refine_steps += ws[t].refine_steps;
+    stats->refine_fallbacks += ws[t].refine_fallbacks;
+    stats->flops += ws[t].flops;
+    for (b = 0; b < HIST_BINS; b++) {
+      stats->dim_hist[b] += ws[t].dim_hist[b];
+      stats->time_hist[b] += ws[t].time_hist[b];
+    }
+  }
+}
+
+/* Per-rank summary of a job, printed by every rank that solved submatrices. */
+void print_solve_stats(int rank, struct solver_options *opts,
+                       struct solve_stats *stats, double tStart, double tEnd) {
+  printf("%d: Wall time elapsed: %dms\n", rank, (int)((tEnd-tStart)*1000));
+  printf("%d: CPU time sm build: %dms\n", rank, (int)(stats->build*1000));
+  printf("%d: CPU time sm calc: %dms\n", rank, (int)(stats->calc*1000));
+  printf("%d: Estimated %.3f GFLOP, %.2f GFLOP/s.\n", rank, stats->flops/1e9,
+         tEnd > tStart ? stats->flops/1e9/(tEnd-tStart) : 0.);
+  if (opts->group && stats->submatrices > 0) {
+    printf("%d: Grouping solved %d columns with %d submatrices (%.2fx fewer, "
+           "%.2fx less estimated flops).\n", rank, stats->columns,
+           stats->submatrices, (double)stats->columns / stats->submatrices,
+           stats->cost_submatrices > .0 ?
+           stats->cost_columns / stats->cost_submatrices : 1.);
+  }
+  if (stats->large_dim_max == 0) {
+    printf("%d: Solved all submatrices with 1 MKL thread each.\n", rank);
+  } else if (stats->large_dim_min == stats->large_dim_max) {
+    printf("%d: Solved %d submatrices above dimension %d first, with %d MKL "
+           "threads each.\n", rank, stats->large, stats->large_dim_max,
+           omp_get_max_threads());
+  } else {
+    printf("%d: Solved %d submatrices above dimension %d to %d (chosen per "
+           "chunk) first, with %d MKL threads each.\n", rank, stats->large,
+           stats->large_dim_min, stats->large_dim_max, omp_get_max_threads());
+  }
+  if (opts->batch_max_dim > 0) {
+    printf("%d: Solved %d of %d submatrices (dimension <= %d) in %d batches "
+           "of %d.\n", rank, stats->batched, stats->submatrices,
+           opts->batch_max_dim, stats->batches, BATCH_LANES);
+  }
+  if (opts->precision == PRECISION_MIXED) {
+    printf("%d: Mixed precision: %d submatrices refined to double accuracy "
+           "in %.2f steps on average, %d factored in double instead.\n", rank,
+           stats->refined, stats->refined ?
+           (double)stats->refine_steps / stats->refined : 0.,
+           stats->refine_fallbacks);
+  }
+}
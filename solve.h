@@ -0,0 +1,52 @@
+#ifndef SOLVE_H
+#define SOLVE_H
+
+#include <mkl.h>
+#include "submatrix.h"
+#include "workspace.h"
+
+/* What a rank did while solving its submatrices. */
+struct solve_stats {
+  double build;            // CPU time spent building submatrices
+  double calc;             // CPU time spent solving them
+  MKL_INT columns;         // result columns computed
+  MKL_INT submatrices;     // submatrices solved for these columns
+  MKL_INT batched;         // submatrices solved by the batched kernels
+  MKL_INT batches;         // number of batches they were solved in
+  MKL_INT large;           // submatrices solved with all threads in MKL
+  MKL_INT large_dim_min;   // smallest and largest threshold used for that,
+  MKL_INT large_dim_max;   // they differ if it is chosen per chunk
+  double cost_columns;     // estimated cost with one submatrix per column
+  double cost_submatrices; // estimated cost of the submatrices solved
+  MKL_INT refined;         // mixed precision solves that converged,
+  MKL_INT refine_steps;    // the refinement steps they needed
+  MKL_INT refine_fallbacks; // and solves that were factored in double
+  double flops;            // estimated, see submatrix_flops
+  MKL_INT dim_hist[HIST_BINS];  // submatrices by dimension and time, see
+  MKL_INT time_hist[HIST_BINS]; // workspace_count
+};
+
+struct solver_options *resolve_large_dim(struct solver_options *opts,
+                                         struct solver_options *resolved,
+                                         MKL_INT *col_ptr, MKL_INT first_col,
+                                         MKL_INT *cols, MKL_INT ncols,
+                                         struct solve_stats *stats);
+MKL_INT solve_large_columns(double *values, MKL_INT *row_ind,
+                            MKL_INT *col_ptr, double *values_inv,
+                            MKL_INT first_col, MKL_INT *cols, MKL_INT ncols,
+                            struct solver_options *opts, struct workspace *ws,
+                            double *build, double *calc);
+void solve_columns(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                   double *values_inv, MKL_INT first_col, MKL_INT last_col,
+                   struct solver_options *opts, struct workspace *ws,
+                   struct solve_stats *stats);
+void solve_column_list(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                       double *values_inv, MKL_INT first_col, MKL_INT *cols,
+                       MKL_INT ncols, struct solver_options *opts,
+                       struct workspace *ws, struct solve_stats *stats);
+void collect_workspaces(struct workspace *ws, int num,
+                        struct solve_stats *stats);
+void print_solve_stats(int rank, struct solver_options *opts,
+                       struct solve_stats *stats, double tStart, double tEnd);
+
+#endif
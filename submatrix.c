@@ -0,0 +1,372 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <mkl.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "submatrix.h"
+#include "trace.h"
+#include "workspace.h"
+
+MKL_INT find_elem(MKL_INT needle, MKL_INT *haystack, MKL_INT size) {
+  MKL_INT l, r, c;
+  l = 0;
+  r = size;
+  do {
+    c = (l+r)/2;
+    if (haystack[c] == needle) {
+      return c;
+    }
+    if (haystack[c] < needle) {
+      l = c+1;
+    } else {
+      r = c;
+    }
+  } while (l != r);
+  return -1;
+}
+
+/* Textbook flop count of solving a submatrix of dimension dim for nrhs
+ * columns with the chosen method. Mixed precision counts like double, the
+ * refinement steps are a few matrix-vector products. */
+double submatrix_flops(MKL_INT dim, MKL_INT nrhs, struct solver_options *opts) {
+  double n = (double)dim;
+  switch (opts->method) {
+    case SOLVER_INVERSE:
+      return 2.*n*n*n;                   // ?getrf and ?getri
+    case SOLVER_CHOLESKY:
+      return n*n*n/3. + 2.*n*n*nrhs;     // ?potrf and ?potrs
+    case SOLVER_EIGEN:
+      return 9.*n*n*n + 2.*n*n*nrhs;     // ?syevd and the root
+    default:
+      return 2.*n*n*n/3. + 2.*n*n*nrhs;  // ?getrf and ?getrs
+  }
+}
+
+lapack_int invert_matrix(double *matrix, lapack_int size,
+                         struct workspace *ws) {
+  // First we need to compute the LU factorization using ?getrf
+  lapack_int *ipiv, ret, lwork;
+  double *work;
+  ipiv = (lapack_int*) workspace_alloc(ws, size*sizeof(lapack_int));
+
+  ret = LAPACKE_dgetrf(LAPACK_COL_MAJOR, size, size, matrix, size, ipiv);
+  if (ret) {
+    return ret;
+  }
+
+  // And now we calculate the inverse using the LU factorization
+  lwork = ws->lwork_getri;
+  work = (double*) workspace_alloc(ws, lwork*sizeof(double));
+  return LAPACKE_dgetri_work(LAPACK_COL_MAJOR, size, matrix, size, ipiv, work,
+                             lwork);
+}
+
+/* Compute the columns idx[0..nrhs-1] of the inverse of matrix without forming
+ * the inverse: factorize once and solve for the unit vectors e_idx[c]. matrix
+ * is overwritten with its factorization and x receives the size*nrhs entries
+ * of the columns. */
+lapack_int solve_unit_columns(double *matrix, lapack_int size,
+                              lapack_int *idx, lapack_int nrhs, int method,
+                              double *x, struct workspace *ws) {
+  lapack_int *ipiv, ret, c;
+
+  memset(x, 0, size*nrhs*sizeof(double));
+  for (c = 0; c < nrhs; c++) {
+    x[c*size + idx[c]] = 1.;
+  }
+
+  if (method == SOLVER_CHOLESKY) {
+    ret = LAPACKE_dpotrf(LAPACK_COL_MAJOR, 'L', size, matrix, size);
+    if (ret) {
+      return ret;
+    }
+    return LAPACKE_dpotrs(LAPACK_COL_MAJOR, 'L', size, nrhs, matrix, size, x,
+                          size);
+  }
+
+  ipiv = (lapack_int*) workspace_alloc(ws, size*sizeof(lapack_int));
+  ret = LAPACKE_dgetrf(LAPACK_COL_MAJOR, size, size, matrix, size, ipiv);
+  if (ret == 0) {
+    ret = LAPACKE_dgetrs(LAPACK_COL_MAJOR, 'N', size, nrhs, matrix, size, ipiv,
+                         x, size);
+  }
+  return ret;
+}
+
+/* Like solve_unit_columns, but with the factorization in single precision
+ * and the solution refined against matrix in double (?sgesv, ?sposv). If
+ * that does not converge, as for ill-conditioned submatrices, LAPACK factors
+ * in double itself. ws counts how it went. matrix is kept unless the double
+ * factorization was needed. */
+lapack_int refine_unit_columns(double *matrix, lapack_int size,
+                               lapack_int *idx, lapack_int nrhs, int method,
+                               double *x, struct workspace *ws) {
+  lapack_int *ipiv, ret, iter, c;
+  double *b, *work;
+  float *swork;
+
+  b = (double*) workspace_calloc(ws, size*nrhs, sizeof(double));
+  for (c = 0; c < nrhs; c++) {
+    b[c*size + idx[c]] = 1.;
+  }
+  work = (double*) workspace_alloc(ws, size*nrhs*sizeof(double));
+  swork = (float*) workspace_alloc(ws, size*(size+nrhs)*sizeof(float));
+
+  if (method == SOLVER_CHOLESKY) {
+    ret = LAPACKE_dsposv_work(LAPACK_COL_MAJOR, 'L', size, nrhs, matrix, size,
+                              b, size, x, size, work, swork, &iter);
+  } else {
+    ipiv = (lapack_int*) workspace_alloc(ws, size*sizeof(lapack_int));
+    ret = LAPACKE_dsgesv_work(LAPACK_COL_MAJOR, size, nrhs, matrix, size,
+                              ipiv, b, size, x, size, work, swork, &iter);
+  }
+  if (ret == 0 && iter >= 0) {
+    ws->refined++;
+    ws->refine_steps += iter;
+  } else if (ret == 0) {
+    ws->refine_fallbacks++;
+  }
+  return ret;
+}
+
+/* Compute the columns idx[0..nrhs-1] of matrix^(-1/p) for a symmetric matrix.
+ * With the eigendecomposition matrix = V diag(w) V^T, column idx is
+ * V diag(w^(-1/p)) V^T e_idx, so we only scale rows of V and multiply by V
+ * instead of forming the whole function matrix. matrix is overwritten with
+ * the eigenvectors. */
+lapack_int root_unit_columns(double *matrix, lapack_int size, lapack_int *idx,
+                             lapack_int nrhs, int p, double *x,
+                             struct workspace *ws) {
+  lapack_int ret, j, c, *iwork;
+  double *w, *scaled, *work;
+
+  w = (double*) workspace_alloc(ws, size*sizeof(double));
+  work = (double*) workspace_alloc(ws, ws->lwork_syevd*sizeof(double));
+  iwork = (lapack_int*) workspace_alloc(ws,
+                                        ws->liwork_syevd*sizeof(lapack_int));
+  ret = LAPACKE_dsyevd_work(LAPACK_COL_MAJOR, 'V', 'L', size, matrix, size, w,
+                            work, ws->lwork_syevd, iwork, ws->liwork_syevd);
+  if (ret) {
+    return ret;
+  }
+
+  scaled = (double*) workspace_alloc(ws, size*nrhs*sizeof(double));
+  for (j = 0; j < size; j++) {
+    w[j] = pow(w[j], -1./p);
+  }
+  for (c = 0; c < nrhs; c++) {
+    for (j = 0; j < size; j++) {
+      scaled[c*size + j] = w[j] * matrix[j*size + idx[c]];
+    }
+  }
+  cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, size, nrhs, size, 1.,
+              matrix, size, scaled, size, 0., x, size);
+  return 0;
+}
+
+void print_matrix(double *matrix, MKL_INT size) {
+  MKL_INT i, j;
+  for (i = 0; i < size; i++) {
+    for (j = 0; j < size; j++) {
+      printf("%.2f\t", matrix[i * size + j]);
+    }
+    printf("\n");
+  }
+  printf("\n");
+}
+
+/* Build the submatrix spanned by pattern, i.e. M restricted to the dim rows
+ * and columns listed there. submatrix must be zeroed and hold dim*dim
+ * entries, each stride doubles apart. Entry M[kcal][lcal] goes to
+ * submatrix[(k*dim+l)*stride] with either method, so both give identical
+ * results. */
+void assemble_pattern(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                      MKL_INT *pattern, MKL_INT dim, int method,
+                      MKL_INT stride, double *submatrix) {
+  MKL_INT k, l, kcal, lcal, idx, p, end;
+
+  if (method == ASSEMBLY_SEARCH) {
+    for (k = 0; k < dim; k++) {
+      for (l = 0; l < dim; l++) {
+        kcal = pattern[k];
+        lcal = pattern[l];
+        // We now have to copy M[kcal][lcal] to submatrix[k][l]
+        // How to access M[kcal][lcal]? Calculate idx
+        idx = find_elem(kcal, &(row_ind[col_ptr[lcal]]),
+                        col_ptr[lcal+1]-col_ptr[lcal]);
+        if (idx != -1) {
+          submatrix[(k*dim+l)*stride] = values[col_ptr[lcal] + idx];
+        }
+      }
+    }
+    return;
+  }
+
+  /* Both the pattern and the row indices of every neighbour column are
+   * sorted, so a single merge over each neighbour column finds all entries we
+   * need. This is O(sum of neighbour column lengths) instead of
+   * O(dim^2 log). */
+  for (l = 0; l < dim; l++) {
+    lcal = pattern[l];
+    p = col_ptr[lcal];
+    end = col_ptr[lcal+1];
+    k = 0;
+    while (k < dim && p < end) {
+      if (row_ind[p] < pattern[k]) {
+        p++;
+      } else if (row_ind[p] > pattern[k]) {
+        k++;
+      } else {
+        submatrix[(k*dim+l)*stride] = values[p];
+        k++;
+        p++;
+      }
+    }
+  }
+}
+
+/* The usual submatrix for column i, spanned by the pattern of that column. */
+void assemble_submatrix(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                        MKL_INT i, int method, MKL_INT stride,
+                        double *submatrix) {
+  assemble_pattern(values, row_ind, col_ptr, &(row_ind[col_ptr[i]]),
+                   col_ptr[i+1] - col_ptr[i], method, stride, submatrix);
+}
+
+/* assemble_pattern for a submatrix of the matrix in values, row_ind and
+ * col_ptr. If that is a filtered matrix whose dropped entries should still
+ * count (see filter_keep_values), the values come from the full one. */
+void assemble_values(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                     MKL_INT *pattern, MKL_INT dim, int method,
+                     MKL_INT stride, double *submatrix,
+                     struct workspace *ws) {
+  if (ws->filter) {
+    values = ws->filter->full_values;
+    row_ind = ws->filter->full_row_ind;
+    col_ptr = ws->filter->full_col_ptr;
+  }
+  assemble_pattern(values, row_ind, col_ptr, pattern, dim, method, stride,
+                   submatrix);
+}
+
+/* Solve one submatrix spanned by pattern for the columns cols[0..ncols-1],
+ * whose patterns all have to be subsets of pattern. The result for column
+ * cols[c] has as many entries as that column and is written to out[c]. All
+ * scratch memory comes from ws, which is reset on entry. */
+void solve_submatrix(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                     MKL_INT *pattern, MKL_INT dim, MKL_INT *cols,
+                     MKL_INT ncols, double **out, struct solver_options *opts,
+                     struct workspace *ws, double *locDurBuild,
+                     double *locDurCalc) {
+
+  MKL_INT c, k, q, len, *col_pattern;
+  lapack_int ret, *idx;
+  double *submatrix, *x;
+  double tStart, tEnd;
+
+  workspace_prepare(ws, dim, ncols, opts);
+  submatrix = (double*) workspace_calloc(ws, dim*dim, sizeof(double));
+
+  tStart = omp_get_wtime();
+  assemble_values(values, row_ind, col_ptr, pattern, dim, opts->assembly, 1,
+                  submatrix, ws);
+  tEnd = omp_get_wtime();
+  *locDurBuild = (tEnd - tStart);
+  trace_event(TRACE_ASSEMBLY, cols[0], dim, ncols, tStart, tEnd);
+
+  idx = (lapack_int*) workspace_alloc(ws, ncols*sizeof(lapack_int));
+  for (c = 0; c < ncols; c++) {
+    idx[c] = find_elem(cols[c], pattern, dim);
+  }
+  // A single column spanning the submatrix needs no extraction afterwards
+  if (ncols == 1 && col_ptr[cols[0]+1] - col_ptr[cols[0]] == dim) {
+    x = out[0];
+  } else {
+    x = (double*) workspace_alloc(ws, dim*ncols*sizeof(double));
+  }
+
+  tStart = omp_get_wtime();
+  if (opts->method == SOLVER_INVERSE) {
+    ret = invert_matrix(submatrix, dim, ws);
+    for (c = 0; c < ncols; c++) {
+      memcpy(&(x[c*dim]), &(submatrix[idx[c] * dim]), dim*sizeof(double));
+    }
+  } else if (opts->method == SOLVER_EIGEN) {
+    ret = root_unit_columns(submatrix, dim, idx, ncols, opts->p, x, ws);
+  } else {
+    if (opts->precision == PRECISION_MIXED) {
+      ret = refine_unit_columns(submatrix, dim, idx, ncols, opts->method, x,
+                                ws);
+    } else {
+      ret = solve_unit_columns(submatrix, dim, idx, ncols, opts->method, x,
+                               ws);
+    }
+    if (ret > 0 && opts->method == SOLVER_CHOLESKY) {
+      // Not positive definite. The factorization destroyed the submatrix,
+      // so build it again and take the LU route.
+      memset(submatrix, 0, dim*dim*sizeof(double));
+      assemble_values(values, row_ind, col_ptr, pattern, dim, opts->assembly,
+                      1, submatrix, ws);
+      ret = solve_unit_columns(submatrix, dim, idx, ncols, SOLVER_LU, x, ws);
+    }
+  }
+  tEnd = omp_get_wtime();
+  *locDurCalc = (tEnd - tStart);
+  trace_event(TRACE_FACTOR, cols[0], dim, ncols, tStart, tEnd);
+  if (ret) {
+    fprintf(stderr, "Inverting submatrix failed\n");
+  }
+  workspace_count(ws, dim, submatrix_flops(dim, ncols, opts),
+                  *locDurBuild + *locDurCalc);
+
+  if (x != out[0]) {
+    // Pick the rows of each column's own pattern out of the larger result
+    tStart = trace_clock();
+    for (c = 0; c < ncols; c++) {
+      len = col_ptr[cols[c]+1] - col_ptr[cols[c]];
+      col_pattern = &(row_ind[col_ptr[cols[c]]]);
+      for (k = 0, q = 0; q < len; k++) {
+        if (pattern[k] == col_pattern[q]) {
+          out[c][q++] = x[c*dim + k];
+        }
+      }
+    }
+    trace_event(TRACE_EXTRACT, cols[0], dim, ncols, tStart, trace_clock());
+  }
+}
+
+void invert_submatrix(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                      double *values_inv, int i, struct solver_options *opts,
+                      struct workspace *ws, double *locDurBuild,
+                      double *locDurCalc) {
+  MKL_INT col = i;
+  solve_submatrix(values, row_ind, col_ptr, &(row_ind[col_ptr[i]]),
+                  col_ptr[i+1] - col_ptr[i], &col, 1, &values_inv, opts, ws,
+                  locDurBuild, locDurCalc);
+}
@@ -0,0 +1,74 @@
+#ifndef SUBMATRIX_H
+#define SUBMATRIX_H
+
+#include <mkl.h>
+#include "workspace.h"
+
+/* How the dense submatrix is assembled from the CSC input. */
+enum assembly_method {
+  ASSEMBLY_MERGE  = 0, // merge each neighbour column with the column pattern
+  ASSEMBLY_SEARCH = 1  // binary search for each of the dim^2 entries
+};
+
+/* How the needed column of the submatrix inverse is computed. */
+enum solver_method {
+  SOLVER_INVERSE  = 0, // full inverse with ?getrf and ?getri
+  SOLVER_LU       = 1, // ?getrf, then ?getrs for the single unit vector
+  SOLVER_CHOLESKY = 2, // ?potrf and ?potrs, falls back to LU if not SPD
+  SOLVER_EIGEN    = 3  // ?syevd, needed for inverse p-th roots with p > 1
+};
+
+/* The precision ?getrf and ?potrf work in. */
+enum precision {
+  PRECISION_DOUBLE = 0,
+  PRECISION_MIXED  = 1  // factor in single, refine the solution in double
+};
+
+/* Everything that decides how a single submatrix is solved. This is part of
+ * the job properties rank 0 broadcasts to the workers. */
+struct solver_options {
+  int assembly;
+  int method;
+  int p; // compute the inverse p-th root, 1 is the plain inverse
+  int group; // share submatrices between columns, see group_columns
+  int group_growth;
+  int batch_max_dim; // solve submatrices up to this size in batches
+  int large_dim; // solve bigger ones first with all threads, -1 picks one
+  int precision; // for SOLVER_LU and SOLVER_CHOLESKY, see enum precision
+};
+
+double submatrix_flops(MKL_INT dim, MKL_INT nrhs, struct solver_options *opts);
+MKL_INT find_elem(MKL_INT needle, MKL_INT *haystack, MKL_INT size);
+lapack_int invert_matrix(double *matrix, lapack_int size,
+                         struct workspace *ws);
+lapack_int solve_unit_columns(double *matrix, lapack_int size,
+                              lapack_int *idx, lapack_int nrhs, int method,
+                              double *x, struct workspace *ws);
+lapack_int refine_unit_columns(double *matrix, lapack_int size,
+                               lapack_int *idx, lapack_int nrhs, int method,
+                               double *x, struct workspace *ws);
+lapack_int root_unit_columns(double *matrix, lapack_int size, lapack_int *idx,
+                             lapack_int nrhs, int p, double *x,
+                             struct workspace *ws);
+void print_matrix(double *matrix, MKL_INT size);
+void assemble_pattern(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                      MKL_INT *pattern, MKL_INT dim, int method,
+                      MKL_INT stride, double *submatrix);
+void assemble_submatrix(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                        MKL_INT i, int method, MKL_INT stride,
+                        double *submatrix);
+void assemble_values(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                     MKL_INT *pattern, MKL_INT dim, int method,
+                     MKL_INT stride, double *submatrix,
+                     struct workspace *ws);
+void solve_submatrix(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                     MKL_INT *pattern, MKL_INT dim, MKL_INT *cols,
+                     MKL_INT ncols, double **out, struct solver_options *opts,
+                     struct workspace *ws, double *locDurBuild,
+                     double *locDurCalc);
+void invert_submatrix(double *values, MKL_INT *row_ind, MKL_INT *col_ptr,
+                      double *values_inv, int i, struct solver_options *opts,
+                      struct workspace *ws, double *locDurBuild,
+                      double *locDurCalc);
+
+#endif
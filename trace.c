@@ -0,0 +1,209 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mkl.h>
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+/* The ring buffer of one thread. Only its thread writes to it, so it needs
+ * no locks, and the padding keeps the counters of two threads apart. */
+struct trace_buffer {
+  struct trace_record *rec;
+  long count; // records ever stored, the next goes to count % capacity
+  char pad[64 - sizeof(struct trace_record*) - sizeof(long)];
+};
+
+int trace_on = 0;
+static struct trace_buffer *buffers = NULL;
+static int num_buffers = 0;
+
+static const char *event_names[TRACE_EVENTS] = {
+  "assembly", "factorization", "extraction", "read", "distribute", "solve",
+  "output", "residual"
+};
+
+/* Start tracing with a buffer for each of the threads we have */
+void trace_init(void) {
+  int t;
+  if (trace_on) {
+    return;
+  }
+  num_buffers = omp_get_max_threads();
+  buffers = (struct trace_buffer*) calloc(num_buffers,
+                                          sizeof(struct trace_buffer));
+  for (t = 0; t < num_buffers; t++) {
+    buffers[t].rec = (struct trace_record*) malloc(TRACE_CAPACITY *
+                                                   sizeof(struct trace_record));
+  }
+  trace_on = 1;
+}
+
+void trace_store(int event, MKL_INT col, MKL_INT dim, int ncols, double start,
+                 double end) {
+  int t = omp_get_thread_num();
+  struct trace_record *r;
+
+  if (t >= num_buffers) {
+    return; // a nested team we did not plan for
+  }
+  r = &(buffers[t].rec[buffers[t].count % TRACE_CAPACITY]);
+  r->start = start;
+  r->end = end;
+  r->col = col;
+  r->dim = dim;
+  r->event = event;
+  r->ncols = ncols;
+  buffers[t].count++;
+}
+
+/* Write the records of all ranks in comm to path as a Chrome trace, which
+ * chrome://tracing and Perfetto show as a timeline with a row per thread.
+ * Collective, only rank 0 writes. The clocks of the ranks are aligned at a
+ * barrier, which is good to a few microseconds. */
+void trace_write(const char *path, MPI_Comm comm) {
+  struct trace_record *mine, *all = NULL, *r;
+  int rank, size, t, p, *counts = NULL, *displs = NULL, num = 0, *threads;
+  int *all_threads = NULL, total = 0, dropped = 0;
+  long k, first;
+  double now, base = .0, *offsets = NULL;
+  FILE *fp = NULL;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  // Records of all threads back to back, the oldest of each thread first
+  for (t = 0; t < num_buffers; t++) {
+    num += buffers[t].count < TRACE_CAPACITY ? buffers[t].count :
+           TRACE_CAPACITY;
+    dropped += buffers[t].count > TRACE_CAPACITY ?
+               buffers[t].count - TRACE_CAPACITY : 0;
+  }
+  mine = (struct trace_record*) malloc((num ? num : 1) *
+                                       sizeof(struct trace_record));
+  threads = (int*) malloc((num ? num : 1) * sizeof(int));
+  for (t = 0, p = 0; t < num_buffers; t++) {
+    first = buffers[t].count > TRACE_CAPACITY ?
+            buffers[t].count - TRACE_CAPACITY : 0;
+    for (k = first; k < buffers[t].count; k++, p++) {
+      mine[p] = buffers[t].rec[k % TRACE_CAPACITY];
+      threads[p] = t;
+    }
+    free(buffers[t].rec);
+  }
+  free(buffers);
+  buffers = NULL;
+  num_buffers = 0;
+  trace_on = 0;
+
+  MPI_Barrier(comm);
+  now = omp_get_wtime();
+  if (rank == 0) {
+    counts = (int*) calloc(size, sizeof(int));
+    displs = (int*) calloc(size, sizeof(int));
+    offsets = (double*) calloc(size, sizeof(double));
+  }
+  MPI_Gather(&now, 1, MPI_DOUBLE, offsets, 1, MPI_DOUBLE, 0, comm);
+  MPI_Gather(&num, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+  MPI_Reduce(rank ? &dropped : MPI_IN_PLACE, &dropped, 1, MPI_INT, MPI_SUM, 0,
+             comm);
+  if (rank == 0) {
+    for (p = 1; p < size; p++) {
+      displs[p] = displs[p-1] + counts[p-1];
+    }
+    total = displs[size-1] + counts[size-1];
+    all = (struct trace_record*) malloc((total ? total : 1) *
+                                        sizeof(struct trace_record));
+    all_threads = (int*) malloc((total ? total : 1) * sizeof(int));
+    for (p = 0; p < size; p++) {
+      counts[p] *= sizeof(struct trace_record);
+      displs[p] *= sizeof(struct trace_record);
+    }
+  }
+  MPI_Gatherv(mine, num * sizeof(struct trace_record), MPI_BYTE, all, counts,
+              displs, MPI_BYTE, 0, comm);
+  if (rank == 0) {
+    for (p = 0; p < size; p++) {
+      counts[p] /= sizeof(struct trace_record);
+      displs[p] /= sizeof(struct trace_record);
+    }
+  }
+  MPI_Gatherv(threads, num, MPI_INT, all_threads, counts, displs, MPI_INT, 0,
+              comm);
+  free(threads);
+  free(mine);
+  if (rank != 0) {
+    return;
+  }
+
+  fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, "%s: Cannot open file for writing\n", path);
+  } else {
+    fprintf(fp, "{\"traceEvents\": [\n");
+    for (p = 0; p < size; p++) {
+      fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+              "\"args\": {\"name\": \"rank %d\"}},\n", p, p);
+    }
+    // Times in microseconds since the first event, on the barrier's clock
+    for (p = 0; p < size; p++) {
+      for (k = displs[p]; k < displs[p] + counts[p]; k++) {
+        if (all[k].start - offsets[p] < base) {
+          base = all[k].start - offsets[p];
+        }
+      }
+    }
+    for (p = 0; p < size; p++) {
+      for (k = displs[p]; k < displs[p] + counts[p]; k++) {
+        r = &(all[k]);
+        fprintf(fp, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+                "\"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+                "\"args\": {\"%s\": %d, \"%s\": %d", event_names[r->event],
+                r->event < TRACE_READ ? "submatrix" : "phase", p,
+                all_threads[k], (r->start - offsets[p] - base) * 1e6,
+                (r->end - r->start) * 1e6, r->event < TRACE_READ ? "col" :
+                "input", (int)r->col, r->event < TRACE_READ ? "dim" : "size",
+                (int)r->dim);
+        if (r->ncols > 1) {
+          fprintf(fp, ", \"ncols\": %d", r->ncols);
+        }
+        fprintf(fp, "}},\n");
+      }
+    }
+    // JSON allows no comma after the last event, so end with a marker
+    fprintf(fp, "{\"name\": \"end\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 0, "
+            "\"tid\": 0, \"ts\": %.3f}\n]}\n", -base * 1e6);
+    fclose(fp);
+    printf("0: Wrote %d trace events to %s%s.\n", total, path,
+           dropped ? " (older ones were overwritten)" : "");
+  }
+  free(all_threads);
+  free(all);
+  free(offsets);
+  free(displs);
+  free(counts);
+}
@@ -0,0 +1,58 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <mkl.h>
+#include <mpi.h>
+#include <omp.h>
+
+/* Records kept per thread. When a thread has more, the oldest are
+ * overwritten, so the trace shows the end of the run. */
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY (1 << 16)
+#endif
+
+/* What a trace record stands for. The first ones are the steps of solving a
+ * submatrix, the others phases of a job. */
+enum trace_event {
+  TRACE_ASSEMBLY = 0, // building the dense submatrix
+  TRACE_FACTOR,       // factorization and solve, or inversion
+  TRACE_EXTRACT,      // picking the result columns out of the solution
+  TRACE_READ,         // rank 0 reading the input
+  TRACE_DISTRIBUTE,   // Bcast, halo distribution or MPI-IO input
+  TRACE_SOLVE,        // all submatrices of a rank
+  TRACE_OUTPUT,       // Gatherv or MPI-IO output
+  TRACE_RESIDUAL,     // estimating the residual with -V
+  TRACE_EVENTS
+};
+
+struct trace_record {
+  double start;
+  double end;
+  MKL_INT col;  // first column of the submatrix, the input n for phases
+  MKL_INT dim;  // dimension of the submatrix, lanes of a batch in ncols
+  int event;
+  int ncols;
+};
+
+extern int trace_on;
+
+void trace_init(void);
+void trace_store(int event, MKL_INT col, MKL_INT dim, int ncols, double start,
+                 double end);
+void trace_write(const char *path, MPI_Comm comm);
+
+/* The clock of the trace, not read at all while tracing is off */
+static inline double trace_clock(void) {
+  return trace_on ? omp_get_wtime() : 0.;
+}
+
+/* Record an event of the calling thread. Costs a branch while tracing is
+ * off, so it can sit in the innermost loops. */
+static inline void trace_event(int event, MKL_INT col, MKL_INT dim,
+                               int ncols, double start, double end) {
+  if (trace_on) {
+    trace_store(event, col, dim, ncols, start, end);
+  }
+}
+
+#endif
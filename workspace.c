@@ -0,0 +1,159 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2018 Paderborn Center for Parallel Computing
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <mkl.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "submatrix.h"
+#include "workspace.h"
+
+#define ALIGNMENT 64
+
+static size_t aligned(size_t bytes) {
+  return (bytes + ALIGNMENT-1) / ALIGNMENT * ALIGNMENT;
+}
+
+// Ask LAPACK how much work space it wants for submatrices of dimension dim
+static void query_work_sizes(struct workspace *ws, MKL_INT dim) {
+  double query;
+  lapack_int iquery, lda = dim > 1 ? dim : 1;
+
+  LAPACKE_dgetri_work(LAPACK_COL_MAJOR, dim, NULL, lda, NULL, &query, -1);
+  ws->lwork_getri = (lapack_int) query;
+  if (ws->lwork_getri < dim) {
+    ws->lwork_getri = dim;
+  }
+  LAPACKE_dsyevd_work(LAPACK_COL_MAJOR, 'V', 'L', dim, NULL, lda, NULL,
+                      &query, -1, &iquery, -1);
+  ws->lwork_syevd = (lapack_int) query;
+  ws->liwork_syevd = iquery;
+  ws->dim = dim;
+}
+
+/* One workspace per thread, each big enough for a submatrix of dimension
+ * max_dim. Every thread allocates its own, so the memory ends up close to
+ * the thread that uses it. */
+struct workspace *create_workspaces(int num, MKL_INT max_dim,
+                                    struct solver_options *opts) {
+  struct workspace *ws;
+
+  ws = (struct workspace*) calloc(num, sizeof(struct workspace));
+  #pragma omp parallel num_threads(num)
+  {
+    struct workspace *my = &(ws[omp_get_thread_num()]);
+    workspace_prepare(my, max_dim, 1, opts);
+  }
+  return ws;
+}
+
+void free_workspaces(struct workspace *ws, int num) {
+  int i;
+  for (i = 0; i < num; i++) {
+    mkl_free(ws[i].base);
+  }
+  free(ws);
+}
+
+/* Release all buffers and make sure the next ones can take bytes in total.
+ * The block only grows if it is too small. */
+void workspace_reserve(struct workspace *ws, size_t bytes) {
+  if (bytes > ws->size) {
+    mkl_free(ws->base);
+    ws->base = (char*) mkl_malloc(bytes, ALIGNMENT);
+    ws->size = bytes;
+  }
+  ws->used = 0;
+}
+
+/* Reserve everything a submatrix of dimension dim with nrhs right-hand
+ * sides needs with the given solver: the submatrix, the solutions, pivots
+ * and the LAPACK work arrays. */
+void workspace_prepare(struct workspace *ws, MKL_INT dim, MKL_INT nrhs,
+                       struct solver_options *opts) {
+  int method = opts->method;
+  size_t bytes;
+
+  if (dim > ws->dim) {
+    query_work_sizes(ws, dim);
+  }
+  bytes = aligned(dim*dim*sizeof(double)) +
+          aligned(dim*nrhs*sizeof(double)) +
+          aligned(nrhs*sizeof(lapack_int)) +
+          aligned(dim*sizeof(lapack_int));
+  if (method == SOLVER_INVERSE) {
+    bytes += aligned(ws->lwork_getri*sizeof(double));
+  } else if (method == SOLVER_EIGEN) {
+    bytes += aligned(dim*sizeof(double)) +
+             aligned(dim*nrhs*sizeof(double)) +
+             aligned(ws->lwork_syevd*sizeof(double)) +
+             aligned(ws->liwork_syevd*sizeof(lapack_int));
+  } else if (opts->precision == PRECISION_MIXED) {
+    // Right-hand sides and residuals in double, the copy in single
+    bytes += 2*aligned(dim*nrhs*sizeof(double)) +
+             aligned(dim*(dim+nrhs)*sizeof(float));
+  }
+  workspace_reserve(ws, bytes);
+}
+
+void *workspace_alloc(struct workspace *ws, size_t bytes) {
+  void *p = ws->base + ws->used;
+  ws->used += aligned(bytes);
+  return p;
+}
+
+// Like workspace_alloc, but zeroes the requested bytes (and only those)
+void *workspace_calloc(struct workspace *ws, size_t num, size_t size) {
+  void *p = workspace_alloc(ws, num*size);
+  memset(p, 0, num*size);
+  return p;
+}
+
+/* The histogram bin of x, see HIST_BINS */
+int hist_bin(double x) {
+  int b = 0;
+  for (; x >= 2. && b < HIST_BINS-1; x /= 2.) {
+    b++;
+  }
+  return b;
+}
+
+/* Note a solved submatrix of dimension dim that took seconds */
+void workspace_count(struct workspace *ws, MKL_INT dim, double flops,
+                     double seconds) {
+  ws->flops += flops;
+  ws->dim_hist[hist_bin(dim)]++;
+  ws->time_hist[hist_bin(seconds * 1e6)]++;
+}
+
+MKL_INT max_column_length(MKL_INT *col_ptr, MKL_INT first_col,
+                          MKL_INT last_col) {
+  MKL_INT i, max = 0;
+  for (i = first_col; i < last_col; i++) {
+    if (col_ptr[i+1] - col_ptr[i] > max) {
+      max = col_ptr[i+1] - col_ptr[i];
+    }
+  }
+  return max;
+}
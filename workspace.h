@@ -0,0 +1,52 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <stddef.h>
+#include <mkl.h>
+
+struct filter;
+struct solver_options;
+
+/* Bins of the histograms of submatrix dimension and time. Bin b counts
+ * dimensions in [2^b, 2^(b+1)) and times in [2^b, 2^(b+1)) microseconds,
+ * bin 0 also the shorter ones. */
+#define HIST_BINS 32
+
+/* Scratch memory of one thread for solving submatrices. Buffers are handed
+ * out 64-byte aligned from a single block and all of them are released at
+ * once when the next submatrix is prepared. */
+struct workspace {
+  char *base;
+  size_t size;
+  size_t used;
+  MKL_INT dim;              // LAPACK work sizes below are valid up to dim
+  lapack_int lwork_getri;
+  lapack_int lwork_syevd;
+  lapack_int liwork_syevd;
+  // What refine_unit_columns did with this workspace
+  MKL_INT refined;          // solves that converged in single precision
+  MKL_INT refine_steps;     // refinement steps they took together
+  MKL_INT refine_fallbacks; // solves LAPACK had to factor in double
+  // What was solved with this workspace, see workspace_count
+  double flops;               // estimated, see submatrix_flops
+  MKL_INT dim_hist[HIST_BINS];
+  MKL_INT time_hist[HIST_BINS];
+  // Where submatrices take their values from, see assemble_values
+  struct filter *filter;
+};
+
+struct workspace *create_workspaces(int num, MKL_INT max_dim,
+                                    struct solver_options *opts);
+void free_workspaces(struct workspace *ws, int num);
+void workspace_reserve(struct workspace *ws, size_t bytes);
+void workspace_prepare(struct workspace *ws, MKL_INT dim, MKL_INT nrhs,
+                       struct solver_options *opts);
+void *workspace_alloc(struct workspace *ws, size_t bytes);
+void *workspace_calloc(struct workspace *ws, size_t num, size_t size);
+int hist_bin(double x);
+void workspace_count(struct workspace *ws, MKL_INT dim, double flops,
+                     double seconds);
+MKL_INT max_column_length(MKL_INT *col_ptr, MKL_INT first_col,
+                          MKL_INT last_col);
+
+#endif